@@ -0,0 +1,213 @@
+// Renders synthetic images of several sizes and formats in every output mode and writes one JSON object per run.
+// With --coldstart <binary> it also times whole runs of the command-line renderer on small icons.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <asciirenderer.h>
+#include <colorhelper.h>
+#include <profiler.h>
+#include <renderer.h>
+
+// Generated on every build by bench/revision.cmake
+#if __has_include("bench_revision.h")
+#include "bench_revision.h"
+#else
+#define BENCH_REVISION "unknown"
+#endif
+
+using namespace Magick;
+
+namespace {
+	constexpr int REPETITIONS = 3;
+	constexpr int COLD_START_RUNS = 50;
+	constexpr int ICON_SIZE = 64;
+
+	struct ImageSize {
+		int width;
+		int height;
+	};
+
+	struct OutputMode {
+		const char* name;
+		bool inverted;
+		bool accent;
+		ColorMode cellColor;
+		int colorBits;
+		GlyphMode glyphMode;
+	};
+
+	const ImageSize SIZES[] = {{256, 256}, {1920, 1080}, {6000, 4000}};
+	const char* const FORMATS[] = {"PNG", "JPEG"};
+	const char* const PATTERNS[] = {"gradient", "noise"};
+	const OutputMode MODES[] = {
+		{"plain", false, false, ColorMode::None, 8, GlyphMode::Shade},
+		{"inverted", true, false, ColorMode::None, 8, GlyphMode::Shade},
+		{"accent", false, true, ColorMode::None, 8, GlyphMode::Shade},
+		{"truecolor", false, false, ColorMode::TrueColor, 8, GlyphMode::Shade},
+		{"palette256", false, false, ColorMode::Palette256, 5, GlyphMode::Shade},
+		{"braille", false, false, ColorMode::None, 8, GlyphMode::Braille},
+		{"half_truecolor", false, false, ColorMode::TrueColor, 8, GlyphMode::HalfBlock},
+		{"quadrant_truecolor", false, false, ColorMode::TrueColor, 8, GlyphMode::Quadrant},
+	};
+
+	/// Builds a pattern deterministically, so every run and every version benchmarks the same pixels
+	std::vector<unsigned char> makePixels(const char* pattern, int width, int height) {
+		std::vector<unsigned char> rgb(static_cast<size_t>(width) * height * 3);
+		uint32_t state = 0x2545f491u;
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				unsigned char* p = &rgb[(static_cast<size_t>(j) * width + i) * 3];
+				if (std::strcmp(pattern, "gradient") == 0) {
+					p[0] = static_cast<unsigned char>(255 * i / std::max(1, width - 1));
+					p[1] = static_cast<unsigned char>(255 * j / std::max(1, height - 1));
+					p[2] = static_cast<unsigned char>(255 - p[0] / 2 - p[1] / 2);
+				} else {
+					state ^= state << 13;
+					state ^= state >> 17;
+					state ^= state << 5;
+					p[0] = static_cast<unsigned char>(state);
+					p[1] = static_cast<unsigned char>(state >> 8);
+					p[2] = static_cast<unsigned char>(state >> 16);
+				}
+			}
+		}
+		return rgb;
+	}
+
+	Blob encode(const std::vector<unsigned char>& rgb, int width, int height, const char* format) {
+		Image image;
+		image.read(width, height, "RGB", CharPixel, rgb.data());
+		image.magick(format);
+		image.quality(90);
+		Blob blob;
+		image.write(&blob);
+		return blob;
+	}
+
+	/// Decodes and renders blob once in the given mode, its stages go to the active profiler
+	size_t renderOnce(const Blob& blob, const OutputMode& mode) {
+		Parameters params;
+		params.inverted = mode.inverted;
+		params.cellColor = mode.cellColor;
+		params.colorBits = mode.colorBits;
+		params.glyphMode = mode.glyphMode;
+		params.threads = 1;
+
+		const Image reduced = decodeForRender(params, blob);
+		Renderer renderer(params);
+		std::string art;
+		if (!renderer.render(reduced, art)) throw std::runtime_error(renderer.errorMessage());
+		if (mode.accent) extractAccentColor(reduced);
+		return art.size();
+	}
+
+	// Runs binary on the icon at path with its output discarded and returns the wall time in milliseconds
+	double timeProcess(const char* binary, const std::string& path) {
+		const auto start = std::chrono::steady_clock::now();
+		const pid_t child = ::fork();
+		if (child == 0) {
+			const int null = ::open("/dev/null", O_WRONLY);
+			::dup2(null, STDOUT_FILENO);
+			::dup2(null, STDERR_FILENO);
+			::execl(binary, binary, "-i", path.c_str(), "-w", "32", "-p", static_cast<char*>(nullptr));
+			::_exit(127);
+		}
+		int status = 0;
+		::waitpid(child, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) throw std::runtime_error(std::string("Cold start run failed: ") + binary);
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/// Process startup to finished art for a small icon, once through a built-in decoder (PGM) and once through ImageMagick (PNG)
+	void benchColdStart(const char* binary, std::ostream& out) {
+		const std::vector<unsigned char> rgb = makePixels("gradient", ICON_SIZE, ICON_SIZE);
+		const std::string pgmPath = "bench_icon.pgm";
+		{
+			std::ofstream pgm(pgmPath, std::ios::binary);
+			pgm << "P5\n" << ICON_SIZE << ' ' << ICON_SIZE << "\n255\n";
+			for (size_t i = 0; i < rgb.size(); i += 3) pgm.put(static_cast<char>((rgb[i] + rgb[i + 1] + rgb[i + 2]) / 3));
+		}
+		const std::string pngPath = "bench_icon.png";
+		{
+			const Blob png = encode(rgb, ICON_SIZE, ICON_SIZE, "PNG");
+			std::ofstream file(pngPath, std::ios::binary);
+			file.write(static_cast<const char*>(png.data()), png.length());
+		}
+
+		for (const std::string& path : {pgmPath, pngPath}) {
+			std::vector<double> times;
+			for (int r = 0; r < COLD_START_RUNS; r++) times.push_back(timeProcess(binary, path));
+			std::sort(times.begin(), times.end());
+			out << "{\"revision\":\"" << BENCH_REVISION << "\",\"bench\":\"cold_start\",\"format\":\""
+			    << (path == pgmPath ? "PGM" : "PNG") << "\",\"width\":" << ICON_SIZE << ",\"height\":" << ICON_SIZE
+			    << ",\"ms_min\":" << times.front() << ",\"ms_median\":" << times[times.size() / 2] << "}" << std::endl;
+		}
+		std::remove(pgmPath.c_str());
+		std::remove(pngPath.c_str());
+	}
+}
+
+int main(int argc, char const* argv[]) {
+	setMagickPath(*argv);
+	ensureMagick();
+
+	std::ofstream file;
+	const char* coldStartBinary = nullptr;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "--output") == 0) {
+			file.open(argv[i + 1]);
+			if (!file) {
+				std::cerr << "Could not open output file: " << argv[i + 1] << std::endl;
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "--coldstart") == 0) {
+			coldStartBinary = argv[i + 1];
+		}
+	}
+	std::ostream& out = file.is_open() ? file : std::cout;
+
+	if (coldStartBinary != nullptr) benchColdStart(coldStartBinary, out);
+
+	for (const ImageSize& size : SIZES) {
+		for (const char* pattern : PATTERNS) {
+			const std::vector<unsigned char> rgb = makePixels(pattern, size.width, size.height);
+			for (const char* format : FORMATS) {
+				const Blob blob = encode(rgb, size.width, size.height, format);
+				for (const OutputMode& mode : MODES) {
+					std::vector<double> totals;
+					std::vector<StageSample> fastestStages;
+					size_t bytes = 0;
+					for (int r = 0; r < REPETITIONS; r++) {
+						Profiler profiler;
+						const auto start = std::chrono::steady_clock::now();
+						bytes = renderOnce(blob, mode);
+						const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+						if (totals.empty() || total < *std::min_element(totals.begin(), totals.end())) {
+							fastestStages = profiler.stages();
+						}
+						totals.push_back(total);
+					}
+					std::sort(totals.begin(), totals.end());
+
+					out << "{\"revision\":\"" << BENCH_REVISION << "\",\"pattern\":\"" << pattern
+					    << "\",\"width\":" << size.width << ",\"height\":" << size.height
+					    << ",\"format\":\"" << format << "\",\"encoded_bytes\":" << blob.length()
+					    << ",\"mode\":\"" << mode.name << "\",\"output_bytes\":" << bytes
+					    << ",\"ms_min\":" << totals.front() << ",\"ms_median\":" << totals[totals.size() / 2]
+					    << ",\"peak_rss_kb\":" << peakRssKb() << ",\"stages\":";
+					writeStagesJson(out, fastestStages);
+					out << "}" << std::endl;
+				}
+			}
+		}
+	}
+	return 0;
+}
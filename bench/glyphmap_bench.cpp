@@ -0,0 +1,149 @@
+// Microbenchmark of the glyph mapping kernel on synthetic luminance planes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <glyphmap.h>
+
+namespace {
+	constexpr auto LUT = makeLUT(false);
+	constexpr auto TABLE = makeGlyphTable(LUT);
+	constexpr int REPETITIONS = 5;
+
+	struct GridSize {
+		int width;
+		int height;
+	};
+
+	/// Diagonal gradient with xorshift noise, so every glyph level and run length shows up
+	std::vector<uint16_t> makePlane(int width, int height) {
+		std::vector<uint16_t> plane(static_cast<size_t>(width) * height);
+		uint32_t state = 0x9e3779b9u;
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				const uint32_t gradient = static_cast<uint32_t>((static_cast<uint64_t>(i + j) * 65535) / (width + height));
+				plane[static_cast<size_t>(j) * width + i] = static_cast<uint16_t>(std::min<uint32_t>(65535, gradient / 2 + (state & 0x7fff)));
+			}
+		}
+		return plane;
+	}
+
+	/// The straightforward per-cell LUT append the kernel replaces, used as reference output
+	std::string referenceArt(const std::vector<uint16_t>& plane, int width, int height) {
+		std::string art;
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				art += LUT[plane[static_cast<size_t>(j) * width + i] / 257];
+			}
+			art += '\n';
+		}
+		return art;
+	}
+
+	/// Per-cell mean, contrast check and sub-pixel compare spelled out, the reference of the sub-cell kernel
+	std::string referenceSubcellArt(const std::vector<uint16_t>& plane, int width, int height, const MaskGlyphTable& table) {
+		std::string art;
+		for (int j = 0; j < height / table.rows; j++) {
+			for (int i = 0; i < width / table.columns; i++) {
+				auto at = [&](int r, int c) { return plane[static_cast<size_t>(j * table.rows + r) * width + i * table.columns + c]; };
+				uint32_t sum = 0;
+				int low = 65535, high = 0;
+				for (int r = 0; r < table.rows; r++) {
+					for (int c = 0; c < table.columns; c++) {
+						sum += at(r, c);
+						low = std::min<int>(low, at(r, c));
+						high = std::max<int>(high, at(r, c));
+					}
+				}
+				const uint32_t threshold = high - low >= 8192 ? sum / (table.rows * table.columns) : 32768;
+				int mask = 0;
+				for (int r = 0; r < table.rows; r++) {
+					for (int c = 0; c < table.columns; c++) {
+						if (at(r, c) > threshold) mask |= 1 << (r * table.columns + c);
+					}
+				}
+				art.append(table.glyphs[mask].data(), table.lengths[mask]);
+			}
+			art += '\n';
+		}
+		return art;
+	}
+}
+
+int main() {
+	const GridSize sizes[] = {{400, 150}, {1920, 1080}, {4096, 4096}, {8192, 8192}};
+	const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+	std::printf("%-12s %7s %12s %10s %10s %10s %10s\n", "grid", "threads", "Mcells/s", "in GB/s", "out GB/s", "ref ms", "kernel ms");
+	for (const GridSize& size : sizes) {
+		const std::vector<uint16_t> plane = makePlane(size.width, size.height);
+		const size_t cells = plane.size();
+
+		auto refStart = std::chrono::steady_clock::now();
+		const std::string expected = referenceArt(plane, size.width, size.height);
+		const double refSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - refStart).count();
+
+		for (unsigned int threads : {1u, cores}) {
+			std::string art;
+			GlyphMapScratch scratch;
+			double best = 1e9;
+			for (int r = 0; r < REPETITIONS; r++) {
+				const auto start = std::chrono::steady_clock::now();
+				mapGlyphs(plane.data(), size.width, size.height, TABLE, art, scratch, threads);
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+			if (art != expected) {
+				std::fprintf(stderr, "Kernel output differs from the LUT reference for %dx%d\n", size.width, size.height);
+				return 1;
+			}
+
+			char grid[32];
+			std::snprintf(grid, sizeof(grid), "%dx%d", size.width, size.height);
+			std::printf("%-12s %7u %12.1f %10.2f %10.2f %10.2f %10.2f\n", grid, threads,
+			            cells / best / 1e6, cells * sizeof(uint16_t) / best / 1e9, art.size() / best / 1e9,
+			            refSeconds * 1e3, best * 1e3);
+			if (cores == 1) break;
+		}
+	}
+
+	// Sub-cell modes on planes of the same cell counts, so the rows compare against the shade kernel above
+	struct SubcellMode {
+		const char* name;
+		GlyphMode mode;
+	};
+	const SubcellMode modes[] = {{"half", GlyphMode::HalfBlock}, {"quadrant", GlyphMode::Quadrant}, {"braille", GlyphMode::Braille}};
+	std::printf("\n%-12s %-9s %12s %10s %10s %10s\n", "cells", "mode", "Mcells/s", "in GB/s", "out GB/s", "kernel ms");
+	for (const GridSize& size : {sizes[0], sizes[1]}) {
+		for (const SubcellMode& mode : modes) {
+			const MaskGlyphTable table = makeMaskGlyphTable(mode.mode);
+			const int width = size.width * table.columns;
+			const int height = size.height * table.rows;
+			const std::vector<uint16_t> plane = makePlane(width, height);
+			const std::string expected = referenceSubcellArt(plane, width, height, table);
+
+			std::string art;
+			GlyphMapScratch scratch;
+			double best = 1e9;
+			for (int r = 0; r < REPETITIONS; r++) {
+				const auto start = std::chrono::steady_clock::now();
+				mapSubcells(plane.data(), width, height, table, false, art, scratch, 1);
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+			if (art != expected) {
+				std::fprintf(stderr, "Sub-cell kernel output differs from the reference for %s %dx%d\n", mode.name, size.width, size.height);
+				return 1;
+			}
+
+			const size_t cells = static_cast<size_t>(size.width) * size.height;
+			char grid[32];
+			std::snprintf(grid, sizeof(grid), "%dx%d", size.width, size.height);
+			std::printf("%-12s %-9s %12.1f %10.2f %10.2f %10.2f\n", grid, mode.name, cells / best / 1e6,
+			            plane.size() * sizeof(uint16_t) / best / 1e9, art.size() / best / 1e9, best * 1e3);
+		}
+	}
+	return 0;
+}
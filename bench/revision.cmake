@@ -0,0 +1,22 @@
+# Writes the git revision of the source tree into a header for bench_suite. The bench_revision target runs it on every
+# build, the header is only rewritten when the revision changed so bench_suite is not recompiled for nothing.
+# Usage: cmake -DSOURCE_DIR=<checkout> -DOUTPUT=<header> -P revision.cmake
+execute_process(
+  COMMAND git rev-parse --short HEAD
+  WORKING_DIRECTORY ${SOURCE_DIR}
+  OUTPUT_VARIABLE revision
+  OUTPUT_STRIP_TRAILING_WHITESPACE
+  ERROR_QUIET
+)
+if(NOT revision)
+  set(revision "unknown")
+endif()
+
+set(content "#define BENCH_REVISION \"${revision}\"\n")
+set(previous "")
+if(EXISTS ${OUTPUT})
+  file(READ ${OUTPUT} previous)
+endif()
+if(NOT "${content}" STREQUAL "${previous}")
+  file(WRITE ${OUTPUT} "${content}")
+endif()
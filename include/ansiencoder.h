@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "glyphmap.h"
+
+/// How glyphs carry the color of their source cell
+enum class ColorMode {
+	None,        // plain glyphs
+	TrueColor,   // 24-bit SGR 38;2;r;g;b
+	Palette256   // xterm 256-color SGR 38;5;n
+};
+
+// Parses a color mode as named on the command line and in daemon requests: none, truecolor or 256.
+// Throws std::invalid_argument for any other name.
+ColorMode parseColorMode(const std::string& name);
+
+/// Counters of everything encoded since the last resetStats, to trade fidelity against bandwidth
+struct EncodeStats {
+	size_t bytes = 0;          // bytes appended, glyphs and escapes
+	size_t cells = 0;          // glyphs appended
+	size_t sgrSequences = 0;   // color escapes appended
+};
+
+/// Turns glyphs with per-cell colors into terminal output, emitting a color escape only when the quantized
+/// color actually changes. The escape state carries over between calls, like the terminal's own.
+class AnsiEncoder {
+public:
+	// bitsPerChannel (1-8) drops low color bits before comparing, fewer bits -> longer runs and fewer escapes
+	explicit AnsiEncoder(ColorMode mode, int bitsPerChannel = 8);
+
+	// Quantizes a color to the key compared between neighbouring cells
+	uint32_t quantize(uint8_t r, uint8_t g, uint8_t b) const;
+
+	// Appends glyph, preceded by a color escape if color differs from the one currently set.
+	// Blank glyphs show no foreground, so they never force an escape.
+	void appendCell(std::string& out, std::string_view glyph, uint32_t color);
+
+	// Same, with a background color for the parts of the cell the glyph leaves empty. Full blocks show no background,
+	// so they never force a background escape. Cells whose two colors are equal become whichever of a space or a
+	// full block needs fewer escapes.
+	void appendCell(std::string& out, std::string_view glyph, uint32_t foreground, uint32_t background);
+
+	// Encodes a grid of glyph levels with one rgb triple per cell, rows separated by newlines, and resets colors at the end
+	void encodeGrid(std::string& out, const uint8_t* levels, const uint8_t* rgb, int width, int height, const GlyphTable& table);
+
+	// Encodes the sub-pixel masks of computeMasks with the rgb plane they were sampled from (width x height sub-pixels):
+	// the set sub-pixels give the foreground color and, for block elements, the unset ones the background color
+	void encodeMaskGrid(std::string& out, const uint8_t* masks, const uint8_t* rgb, int width, int height, const MaskGlyphTable& table);
+
+	// Forgets the colors currently set, the next cell always emits its escapes
+	void reset() { haveColor = haveBackground = false; }
+
+	const EncodeStats& stats() const { return counters; }
+	void resetStats() { counters = {}; }
+
+	ColorMode mode() const { return colorMode; }
+
+private:
+	void appendEscape(std::string& out, uint32_t color, bool background = false);
+
+	ColorMode colorMode;
+	uint8_t keepMask;      // high bits of each channel kept by quantization
+	uint8_t roundingBit;   // middle of the dropped range, so quantized colors are not biased towards black
+	bool haveColor = false;
+	uint32_t current = 0;
+	bool haveBackground = false;
+	uint32_t currentBackground = 0;
+	EncodeStats counters;
+};
+
+// Maps an 8-bit color to the closest entry of the xterm 256-color palette (6x6x6 cube or gray ramp)
+uint8_t toPalette256(uint8_t r, uint8_t g, uint8_t b);
+
+// Writes all of data to stdout with a single write call where the kernel allows it, bypassing iostream buffering
+void writeToStdout(std::string_view data);
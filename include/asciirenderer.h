@@ -4,6 +4,8 @@
 #include <Magick++.h>
 #include <iostream>
 #include <optional>
+#include "ansiencoder.h"
+#include "glyphmap.h"
 
 /// Struct to hold parameters for the ascii-fication of the image
 struct Parameters {
@@ -16,10 +18,49 @@ struct Parameters {
 	double pixelRatio = 2.6666666666;
 	bool inColor = false;
 	bool print = false;
+	unsigned int threads = 0;  // threads for glyph mapping, 0 -> one per hardware thread
+	ColorMode cellColor = ColorMode::None;  // color every glyph with its source cell instead of one accent color
+	int colorBits = 8;         // bits per channel kept when comparing cell colors
+	GlyphMode glyphMode = GlyphMode::Shade;  // sub-pixels sampled per cell, target_width / target_height still count cells
 };
 
+// Remembers the program path for InitializeMagick, which is deferred until ImageMagick is actually needed
+void setMagickPath(const char* path);
+
+// The program path given to setMagickPath, empty if there was none
+const std::string& getMagickPath();
+
+// Initializes ImageMagick on first use, later calls return immediately. Safe to call from any thread.
+void ensureMagick();
+
+// Fills in target_width / target_height for a width x height source, keeping its aspect ratio in mind
+void fitTargetSize(Parameters& params, int width, int height);
+
+// Geometry of the character grid chosen by fitTargetSize, forcing the exact size. In the sub-cell glyph modes every
+// cell is sampled at subcellColumns x subcellRows pixels.
+Magick::Geometry gridGeometry(const Parameters& params);
+
+// Size hint for decoders that can scale while decoding (jpeg:size), about twice the sampled grid
+std::string decodeSizeHint(const Parameters& params);
+
+// Decodes params.in_filepath once, at the smallest size the decoder allows for the requested output, and area-averages
+// it down to the character grid. Fills in the target size of params. The result feeds both Renderer and extractAccentColor.
+Magick::Image decodeForRender(Parameters& params);
+
+// Same as above, but decodes an encoded image held in memory instead of params.in_filepath
+Magick::Image decodeForRender(Parameters& params, const Magick::Blob& data);
+
 // Given a filled out parameter struct, generates and returns an ascii art according to specifications
 std::string renderImage(Parameters params);
 
-// Generates the LUT for instant access to characters
-constexpr std::array<std::string_view, 256> makeLUT(bool inverted);
\ No newline at end of file
+// Same as renderImage, but lets errors propagate as exceptions instead of printing them
+std::string renderImageOrThrow(Parameters params);
+
+// Returns the precomputed LUT, black on white if inverted and white on black otherwise
+const std::array<std::string_view, 256>& getLUT(bool inverted);
+
+// Returns the LUT in the layout of the glyph mapping kernel
+const GlyphTable& getGlyphTable(bool inverted);
+
+// Returns the precomputed mask glyphs of a sub-cell glyph mode
+const MaskGlyphTable& getMaskGlyphTable(GlyphMode mode);
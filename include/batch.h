@@ -0,0 +1,27 @@
+#pragma once
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "asciirenderer.h"
+
+/// Struct to hold the settings of a batch run
+struct BatchOptions {
+	std::string source;                // directory, glob pattern (wildcards in the last component) or "-" for a manifest on stdin
+	std::filesystem::path out_dir;     // root of the mirrored output tree
+	unsigned int jobs = 0;             // worker count, 0 -> one per hardware thread
+};
+
+/// One input of a batch run together with where its rendering goes
+struct BatchItem {
+	std::filesystem::path input;
+	std::filesystem::path output;
+};
+
+// Lists the regular files matching a pattern with '*' / '?' wildcards in its last component, sorted by path
+std::vector<std::filesystem::path> expandGlob(const std::string& pattern);
+
+// Resolves the batch source into a list of inputs and their mirrored output paths
+std::vector<BatchItem> collectBatchItems(const BatchOptions& options);
+
+// Renders every item on a work-stealing thread pool, reports failures on stderr and returns how many failed
+int runBatch(const BatchOptions& options, const Parameters& params);
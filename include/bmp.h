@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// The fields of a BMP with a BITMAPINFOHEADER or one of its successors that the decoder needs
+struct BmpHeader {
+	uint32_t dataOffset = 0;
+	uint32_t headerSize = 0;
+	int32_t width = 0;
+	int32_t height = 0;  // negative for rows stored top-down
+	uint16_t bitsPerPixel = 0;
+	uint32_t compression = 0;
+	uint32_t colorsUsed = 0;
+	uint32_t masks[3] = {0, 0, 0};  // red, green and blue bits of 16 and 32 bit pixels
+};
+
+// Reads the header, false for variants left to ImageMagick: OS/2 headers, RLE, embedded JPEG/PNG and odd depths
+bool parseBmpHeader(const uint8_t* data, size_t size, BmpHeader& header);
+
+/// Decodes the rows of a BMP accepted by parseBmpHeader into rgb triples. Rows are addressed from the top, whichever
+/// order the file stores them in, so any row can be decoded on its own.
+class BmpRows {
+public:
+	// data holds the whole file and has to outlive the decoder. Throws std::runtime_error if it is too short for the
+	// rows or the palette the header announces.
+	BmpRows(const uint8_t* data, size_t size, const BmpHeader& header);
+
+	size_t width() const { return columns; }
+	size_t height() const { return rows; }
+
+	// Where row y of the image is stored in the file and how many bytes it takes there
+	size_t rowOffset(size_t y) const;
+	size_t stride() const { return rowStride; }
+
+	// Writes the width() rgb triples of row y to rgb
+	void decodeRow(size_t y, uint8_t* rgb) const;
+
+private:
+	/// Extracts one channel of a bitfield pixel and scales it to 8 bits
+	struct MaskChannel {
+		uint32_t mask = 0;
+		int shift = 0;
+		uint32_t maximum = 1;
+
+		explicit MaskChannel(uint32_t mask);
+		uint8_t operator()(uint32_t pixel) const { return static_cast<uint8_t>(((pixel & mask) >> shift) * 255 / maximum); }
+	};
+
+	const uint8_t* data;
+	BmpHeader header;
+	size_t columns;
+	size_t rows;
+	size_t rowStride;
+	uint8_t palette[256][3] = {};
+	MaskChannel red, green, blue;
+};
@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/// Fixed-capacity FIFO connecting two pipeline stages. Producers either block when it is full
+/// or evict the oldest element, so a slow consumer sees fresh data instead of a growing backlog.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+	// Blocks while the queue is full. Returns false if the queue was closed.
+	bool push(T value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+		if (closed) return false;
+		items.push_back(std::move(value));
+		lock.unlock();
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// Never blocks: when full, the oldest element is discarded. Returns the number of discarded elements.
+	std::size_t pushDropOldest(T value) {
+		std::size_t dropped = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (closed) return 0;
+			while (items.size() >= capacity) {
+				items.pop_front();
+				dropped++;
+			}
+			items.push_back(std::move(value));
+		}
+		notEmpty.notify_one();
+		return dropped;
+	}
+
+	// Blocks until an element is available. Returns false once the queue is closed and drained.
+	bool pop(T& value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+		if (items.empty()) return false;
+		value = std::move(items.front());
+		items.pop_front();
+		lock.unlock();
+		notFull.notify_one();
+		return true;
+	}
+
+	// Wakes up every waiting producer and consumer, remaining elements can still be popped
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+		}
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+private:
+	const std::size_t capacity;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	bool closed = false;
+};
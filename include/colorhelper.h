@@ -1,5 +1,7 @@
 #pragma once
+#include <cstdint>
 #include <tuple>
+#include <vector>
 #include <Magick++.h>
 #include <iostream>
 
@@ -12,5 +14,27 @@ std::tuple<int,int,int> makeBackgroundColor(int r, int g, int b);
 // Given a color, slightly saturate and brighten it to get a cool font color for the terminal.
 std::tuple<int,int,int> makeForegroundColor(int r, int g, int b);
 
-/// Given an image, downsizes, blurs and quantizes it, then extracts the most vibrant color to serve as an automatic image accent color
+// Given an accent color, returns the escape sequences that set its background and font color in the terminal
+std::string makeAccentEscape(int r, int g, int b);
+
+/// One color of an extracted palette
+struct PaletteColor {
+    int r, g, b;
+    double share;   // fraction of the sampled pixels that belong to this color
+};
+
+/// Clusters interleaved 8-bit RGB pixels into at most count (and at most 256) representative colors, most common first.
+/// Builds a 5-5-5 bit histogram and runs a few weighted k-means iterations over its occupied bins.
+std::vector<PaletteColor> extractPalette(const uint8_t* rgb, size_t pixels, int count = 5);
+
+/// Same as above, for an image. Images larger than the accent sample are downsampled first.
+std::vector<PaletteColor> extractPalette(const Magick::Image& image, int count = 5);
+
+/// Picks the most vibrant color of a palette, scoring saturation * (0.4 + brightness)
+std::tuple<int,int,int> pickAccentColor(const std::vector<PaletteColor>& palette);
+
+/// Given an image, extracts a 5 color palette and returns its most vibrant color to serve as an automatic image accent color
+std::tuple<int,int,int> extractAccentColor(const Magick::Image& image);
+
+/// Same as above, but decodes the image at filepath first
 std::tuple<int,int,int> extractAccentColor(std::string filepath);
\ No newline at end of file
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "asciirenderer.h"
+
+/// Struct to hold the settings of the resident render daemon
+struct DaemonOptions {
+	std::string socket_path;            // Unix domain socket to listen on, replaced if it exists
+	size_t cache_bytes = 256u << 20;    // memory cap of the result cache
+	unsigned int jobs = 0;              // worker threads answering requests, 0 -> one per hardware thread
+};
+
+// Serves render requests on a Unix domain socket until SIGINT / SIGTERM, using params as defaults for every request.
+//
+// Requests are single lines of space separated key=value pairs, answered in order on the same connection:
+//   RENDER [width=N] [height=N] [squish=X] [invert=0|1] [color=none|accent|truecolor|256] [colorbits=N] path=<rest of line>
+//   RENDER [options...] bytes=N      followed by N bytes of an encoded image
+//   STATS
+// Answers are "OK <length> <hit|miss>\n" or "OK <length>\n" for STATS, followed by length bytes of payload,
+// or "ERR <message>\n".
+int runDaemon(const DaemonOptions& options, const Parameters& params);
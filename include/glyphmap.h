@@ -0,0 +1,177 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Generates the LUT for instant access to characters
+constexpr std::array<std::string_view, 256> makeLUT(bool inverted) {
+    std::array<std::string_view, 256> LUT{};
+
+    if (!inverted) {
+        for (int i = 0; i < 256; i++) {
+            if (i < 30)        LUT[i] = " ";
+            else if (i < 90)   LUT[i] = "░";
+            else if (i < 152)  LUT[i] = "▒";
+            else if (i < 219)  LUT[i] = "▓";
+            else               LUT[i] = "█";
+        }
+    } else {
+        for (int i = 0; i < 256; i++) {
+            if (i > 218)       LUT[i] = " ";
+            else if (i > 151)  LUT[i] = "░";
+            else if (i > 89)   LUT[i] = "▒";
+            else if (i > 29)   LUT[i] = "▓";
+            else               LUT[i] = "█";
+        }
+    }
+
+    return LUT;
+}
+
+constexpr size_t MAX_GLYPH_LEVELS = 16;
+
+/// The LUT reduced to its distinct runs, laid out for the mapping kernel: a cell's level is the number of
+/// thresholds its 16-bit quantum reaches, and every glyph sits in a 4-byte slot so it can be copied with one store
+struct GlyphTable {
+	size_t levels = 0;
+	std::array<uint16_t, MAX_GLYPH_LEVELS> thresholds{};        // quantum at which level i+1 starts
+	std::array<std::array<char, 4>, MAX_GLYPH_LEVELS> glyphs{};  // UTF-8 bytes, zero padded
+	std::array<uint8_t, MAX_GLYPH_LEVELS> lengths{};             // real byte count of each glyph
+};
+
+// Builds the kernel table from a 256 entry LUT. Brightness b covers quanta [b * 257, b * 257 + 256], so b = q / 257 exactly.
+constexpr GlyphTable makeGlyphTable(const std::array<std::string_view, 256>& lut) {
+	GlyphTable table{};
+	for (int i = 0; i < 256; i++) {
+		if (i > 0 && lut[i] == lut[i - 1]) continue;
+		if (table.levels == MAX_GLYPH_LEVELS) break;
+		if (i > 0) table.thresholds[table.levels - 1] = static_cast<uint16_t>(i * 257);
+		for (size_t k = 0; k < lut[i].size() && k < 4; k++) table.glyphs[table.levels][k] = lut[i][k];
+		table.lengths[table.levels] = static_cast<uint8_t>(lut[i].size());
+		table.levels++;
+	}
+	return table;
+}
+
+/// How much of the structure inside a cell its glyph shows
+enum class GlyphMode {
+	Shade,      // one mean brightness per cell, drawn with the shade LUT
+	HalfBlock,  // 1x2 sub-pixels per cell: ▀ ▄ █
+	Quadrant,   // 2x2 sub-pixels per cell: the 16 quadrant block elements
+	Braille     // 2x4 sub-pixels per cell: the 256 Braille dot patterns
+};
+
+// Sub-pixels sampled across one cell
+constexpr int subcellColumns(GlyphMode mode) {
+	return mode == GlyphMode::Quadrant || mode == GlyphMode::Braille ? 2 : 1;
+}
+
+// Sub-pixels sampled down one cell
+constexpr int subcellRows(GlyphMode mode) {
+	switch (mode) {
+		case GlyphMode::HalfBlock: return 2;
+		case GlyphMode::Quadrant:  return 2;
+		case GlyphMode::Braille:   return 4;
+		default:                   return 1;
+	}
+}
+
+// Parses a glyph set as named on the command line and in daemon requests: shade, half, quadrant or braille.
+// Throws std::invalid_argument for any other name.
+GlyphMode parseGlyphMode(const std::string& name);
+
+/// Glyph of every sub-pixel mask of a sub-cell mode, in the 4-byte slots of GlyphTable. Bit (row * columns + column)
+/// of a mask is set for the sub-pixels drawn in the foreground.
+struct MaskGlyphTable {
+	int columns = 1;
+	int rows = 1;
+	bool fillsCell = false;  // block elements cover the whole cell, so their unset sub-pixels show the background color
+	std::array<std::array<char, 4>, 256> glyphs{};  // UTF-8 bytes, zero padded
+	std::array<uint8_t, 256> lengths{};             // real byte count of each glyph
+};
+
+// Writes the UTF-8 encoding of a code point below U+10000 into slot and returns its byte count
+constexpr uint8_t encodeUtf8(uint32_t codePoint, std::array<char, 4>& slot) {
+	if (codePoint < 0x80) {
+		slot[0] = static_cast<char>(codePoint);
+		return 1;
+	}
+	if (codePoint < 0x800) {
+		slot[0] = static_cast<char>(0xC0 | codePoint >> 6);
+		slot[1] = static_cast<char>(0x80 | (codePoint & 0x3F));
+		return 2;
+	}
+	slot[0] = static_cast<char>(0xE0 | codePoint >> 12);
+	slot[1] = static_cast<char>(0x80 | (codePoint >> 6 & 0x3F));
+	slot[2] = static_cast<char>(0x80 | (codePoint & 0x3F));
+	return 3;
+}
+
+// Generates the mask table of a sub-cell mode. Empty masks are a plain space, so they cost one byte and no color escape.
+constexpr MaskGlyphTable makeMaskGlyphTable(GlyphMode mode) {
+	// Indexed by mask: bit 0 top left, 1 top right, 2 bottom left, 3 bottom right
+	constexpr uint32_t QUADRANTS[16] = {
+		0x20,   0x2598, 0x259D, 0x2580, 0x2596, 0x258C, 0x259E, 0x259B,
+		0x2597, 0x259A, 0x2590, 0x259C, 0x2584, 0x2599, 0x259F, 0x2588
+	};
+	// Braille dot bit of every mask bit: dots 1-3 and 4-6 run down the two columns, dots 7 and 8 form the bottom row
+	constexpr uint32_t BRAILLE_DOTS[8] = {0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80};
+
+	MaskGlyphTable table{};
+	table.columns = subcellColumns(mode);
+	table.rows = subcellRows(mode);
+	table.fillsCell = mode != GlyphMode::Braille;
+	const int masks = 1 << (table.columns * table.rows);
+	for (int mask = 0; mask < masks; mask++) {
+		uint32_t codePoint = 0x20;
+		if (mode == GlyphMode::Braille) {
+			uint32_t dots = 0;
+			for (int bit = 0; bit < 8; bit++) {
+				if (mask >> bit & 1) dots |= BRAILLE_DOTS[bit];
+			}
+			if (dots != 0) codePoint = 0x2800 + dots;
+		} else if (mode == GlyphMode::Quadrant) {
+			codePoint = QUADRANTS[mask];
+		} else {
+			// Half blocks are the quadrant masks with both columns set alike
+			codePoint = QUADRANTS[(mask & 1) * 3 | (mask >> 1 & 1) * 12];
+		}
+		table.lengths[mask] = encodeUtf8(codePoint, table.glyphs[mask]);
+	}
+	return table;
+}
+
+/// Reusable buffers of the mapping kernel, keep one around to avoid reallocations between renders
+struct GlyphMapScratch {
+	std::vector<uint8_t> levels;       // glyph level of every cell, or its sub-pixel mask in the sub-cell modes
+	std::vector<size_t> rowOffsets;
+	std::vector<uint16_t> thresholds;  // per-cell mask thresholds of the sub-cell modes
+};
+
+// Maps a width x height plane of 16-bit luminance quanta to art with one newline per row, written into out, which is
+// resized to exactly the art's byte count. Row bands are split across the given number of threads for large grids.
+void mapGlyphs(const uint16_t* luma, int width, int height, const GlyphTable& table,
+               std::string& out, GlyphMapScratch& scratch, unsigned int threads = 1);
+
+// Quantizes count quanta to glyph levels, vectorized where the target supports it
+void quantizeLevels(const uint16_t* luma, size_t count, const GlyphTable& table, uint8_t* levels);
+
+// Computes the sub-pixel mask of every cell of a width x height plane sampled at table.columns x table.rows quanta
+// per cell into masks, one byte per cell. A sub-pixel is set when it is brighter than its cell's threshold, or darker
+// if inverted. The threshold is the cell's mean where its sub-pixels differ enough to carry an edge, and mid-gray
+// where they do not, so flat areas come out as solid or empty cells instead of noise.
+void computeMasks(const uint16_t* luma, int width, int height, const MaskGlyphTable& table, bool inverted,
+                  uint8_t* masks, GlyphMapScratch& scratch);
+
+// Same as mapGlyphs for a plane sampled at table.columns x table.rows quanta per cell: width and height count
+// sub-pixels, and sub-pixels that do not fill a whole cell at the right and bottom edge are dropped.
+void mapSubcells(const uint16_t* luma, int width, int height, const MaskGlyphTable& table, bool inverted,
+                 std::string& out, GlyphMapScratch& scratch, unsigned int threads = 1);
+
+// Mean 8-bit colors of the set (foreground) and unset (background) sub-pixels of the cell at (x, y) of an rgb plane
+// sampled like luma for computeMasks. A side without sub-pixels gets the mean of the whole cell.
+void splitCellColors(const uint8_t* rgb, int width, int x, int y, uint8_t mask, const MaskGlyphTable& table,
+                     uint8_t foreground[3], uint8_t background[3]);
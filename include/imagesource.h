@@ -0,0 +1,25 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "asciirenderer.h"
+#include "tiled.h"
+
+/// Where the pixels of a render come from. Every source ends in the same reduced grid planes, so the renderer and
+/// the accent color extraction do not care which decoder ran.
+class ImageSource {
+public:
+	virtual ~ImageSource() = default;
+
+	// Decodes the image and area-averages it down to the character grid, filling in the target size of params
+	virtual ReducedGrid reduce(Parameters& params) = 0;
+};
+
+// Picks a source for the file at path by its leading bytes: built-in decoders for binary PNM (P5/P6), uncompressed
+// and bitfield BMP and QOI, which never touch ImageMagick, and openMagickSource for everything else
+std::unique_ptr<ImageSource> openImageSource(const std::string& path);
+
+// Source decoding the file at path with decodeForRender, whatever its format. Part of the ImageMagick module.
+std::unique_ptr<ImageSource> openMagickSource(const std::string& path);
+
+// Source of one raw 8-bit grayscale image of the given size read from stdin
+std::unique_ptr<ImageSource> openRawSource(int width, int height);
@@ -0,0 +1,26 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "batch.h"
+#include "daemon.h"
+#include "imagesource.h"
+#include "stream.h"
+#include "tiled.h"
+
+/// Entry points into everything that calls ImageMagick. The library links them in directly. The command-line renderer
+/// is linked without ImageMagick and loads them from a shared module the first time an input needs one, so renders of
+/// the built-in formats never load the ImageMagick libraries at all.
+struct MagickModule {
+	std::unique_ptr<ImageSource> (*openSource)(const std::string& path);
+	void (*streamRows)(Parameters& params, size_t memoryBudget, MagickCore::StreamHandler handler);
+	int (*runBatch)(const BatchOptions& options, const Parameters& params);
+	int (*runDaemon)(const DaemonOptions& options, const Parameters& params);
+	StreamStats (*runStream)(const StreamOptions& options, const Parameters& params);
+};
+
+// The entry points, loading the module on first use where it is not linked in. Safe to call from any thread.
+// Throws std::runtime_error if the module cannot be loaded.
+const MagickModule& magickModule();
+
+// Exported by the module for the command-line renderer to look up: the entry points linked into it
+extern "C" const MagickModule* asciirendererMagickModule();
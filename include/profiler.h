@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// Measurements of one profiled stage
+struct StageSample {
+	std::string name;
+	double millis = 0;       // wall time
+	long long allocatedBytes = 0;  // bytes requested from malloc and its relatives by all threads, see bytesAllocated
+	long long heapBytes = 0;       // net growth of the malloc heap in use, negative if the stage freed more (glibc only)
+	long peakRssKb = 0;      // process peak resident set size when the stage ended
+};
+
+/// Collects the stages profiled on the thread that created it, until it is destroyed.
+/// Library code marks its stages with ProfileScope, which costs nothing while no profiler is active.
+class Profiler {
+public:
+	Profiler();
+	~Profiler();
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	void record(StageSample sample) { samples.push_back(std::move(sample)); }
+	const std::vector<StageSample>& stages() const { return samples; }
+
+	// Prints a human-readable table of all stages
+	void report(std::ostream& out) const;
+
+	// The profiler collecting on the calling thread, or nullptr
+	static Profiler* active();
+
+private:
+	std::vector<StageSample> samples;
+	Profiler* previous;
+};
+
+/// Profiles the enclosing block as one stage of the active profiler
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	Profiler* profiler;
+	const char* name;
+	std::chrono::steady_clock::time_point start;
+	long long heapAtStart = 0;
+	long long allocatedAtStart = 0;
+};
+
+// Writes stages as a JSON array, for machine-readable benchmark results
+void writeStagesJson(std::ostream& out, const std::vector<StageSample>& stages);
+
+// Bytes currently allocated from the malloc heap, 0 where the C library cannot tell
+long long heapInUse();
+
+// Bytes requested from malloc and its relatives by the whole process while any Profiler was alive. Only programs that
+// link the allocation counter (alloccounter.cpp, the command-line renderer and bench_suite) count them, the library
+// never replaces the allocator of its host, so everywhere else this stays 0.
+long long bytesAllocated();
+
+// Profilers alive in the process and the bytes counted while there was one, fed by the allocation counter
+extern std::atomic<int> liveProfilers;
+extern std::atomic<long long> allocatedTotal;
+
+// Peak resident set size of the process in KiB
+long peakRssKb();
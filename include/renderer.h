@@ -0,0 +1,76 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "asciirenderer.h"
+
+/// Why a render failed, reported through RenderResult instead of stderr
+enum class RenderError {
+	None,
+	DecodeFailed,     // the input could not be read or decoded
+	EmptyImage,       // the image has no pixels
+	BufferTooSmall,   // the caller-provided buffer cannot hold the art, RenderResult::bytes says how much is needed
+	PixelExport       // the pixels of the image could not be read back
+};
+
+/// Outcome of one render
+struct RenderResult {
+	RenderError error = RenderError::None;
+	size_t bytes = 0;   // bytes of art produced, or needed on BufferTooSmall
+	int width = 0;      // character grid
+	int height = 0;
+
+	explicit operator bool() const { return error == RenderError::None; }
+};
+
+// Receives the finished art of a render in one piece, the data stays valid until the next render
+using RenderSink = void (*)(void* context, const char* data, size_t size);
+
+/// Reusable renderer for embedding: owns its glyph table, pixel scratch buffers, color encoder and output arena.
+/// After the first render of a given grid size, further renders of that size through the image or plane overloads
+/// do no heap allocation of their own as long as mapping runs on one thread (Parameters::threads = 1, or small grids).
+/// Not thread-safe: use one Renderer per thread.
+class Renderer {
+public:
+	explicit Renderer(const Parameters& params);
+
+	// Renders an image already reduced to the character grid (see decodeForRender) into out, reusing its capacity
+	RenderResult render(const Magick::Image& reduced, std::string& out);
+
+	// Renders into a caller-provided buffer without terminating it
+	RenderResult render(const Magick::Image& reduced, char* buffer, size_t capacity);
+
+	// Renders into the internal arena and hands the art to sink
+	RenderResult render(const Magick::Image& reduced, RenderSink sink, void* context);
+
+	// Renders width x height planes of 16-bit luminance quanta and, for per-cell color, 8-bit rgb triples (else nullptr).
+	// In the sub-cell glyph modes the planes hold sub-pixels, subcellColumns x subcellRows of them per cell.
+	RenderResult render(const uint16_t* luma, const uint8_t* rgb, int width, int height, std::string& out);
+
+	// Decodes the file at path through openImageSource and renders it. Decoding allocates, unlike the overloads above.
+	RenderResult renderFile(const std::string& path, std::string& out);
+
+	// Human-readable description of the last error, empty after a successful render
+	const char* errorMessage() const { return message.data(); }
+
+	// Color escape statistics of the last render
+	const EncodeStats& encodeStats() const { return encoder.stats(); }
+
+	const Parameters& parameters() const { return params; }
+
+private:
+	RenderResult fail(RenderError error, const char* what);
+	RenderResult exportPlanes(const Magick::Image& reduced);
+
+	Parameters params;
+	const GlyphTable& table;
+	const MaskGlyphTable& subcells;
+	AnsiEncoder encoder;
+	GlyphMapScratch scratch;
+	std::vector<uint16_t> luma;
+	std::vector<uint8_t> rgb;
+	std::string arena;
+	std::array<char, 256> message{};
+};
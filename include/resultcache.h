@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// Thread-safe LRU cache of rendered art, keyed by content hash plus normalized parameters and capped by memory
+class ResultCache {
+public:
+	explicit ResultCache(size_t capacityBytes);
+
+	// Returns the cached art for key, or nullptr on a miss. A hit makes the entry the most recently used.
+	std::shared_ptr<const std::string> get(const std::string& key);
+
+	// Stores art under key, evicting least recently used entries until everything fits in the cap
+	void put(const std::string& key, std::shared_ptr<const std::string> art);
+
+	size_t hits() const;
+	size_t misses() const;
+	size_t entries() const;
+	size_t bytes() const;
+
+private:
+	struct Entry {
+		std::string key;
+		std::shared_ptr<const std::string> art;
+	};
+
+	static size_t entryBytes(const Entry& entry);
+
+	const size_t capacity;
+	mutable std::mutex mutex;
+	std::list<Entry> order;  // most recently used first
+	std::unordered_map<std::string_view, std::list<Entry>::iterator> index;  // views into the keys of order
+	size_t used = 0;
+	size_t hitCount = 0;
+	size_t missCount = 0;
+};
+
+// 64-bit FNV-1a hash of data, to address cache entries by content
+uint64_t contentHash(std::string_view data);
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include "asciirenderer.h"
+
+/// Struct to hold the settings of an animation / frame stream
+struct StreamOptions {
+	std::string source;   // animated image (GIF, APNG, ...), glob pattern of a frame sequence, or "-" for raw frames on stdin
+	double fps = 0;       // target frame rate, 0 -> the animation's own frame delays (24 fps for sequences and raw frames)
+	int raw_width = 0;    // size of the raw 8-bit grayscale frames read from stdin
+	int raw_height = 0;
+	bool loop = false;    // restart file sources when they run out
+};
+
+/// Counters collected while streaming, to size terminals against throughput
+struct StreamStats {
+	size_t decoded = 0;        // frames that left the decode stage
+	size_t emitted = 0;        // frames written to the terminal
+	size_t droppedSource = 0;  // raw frames discarded because the pipeline was full
+	size_t droppedLate = 0;    // frames skipped because they missed their presentation time
+	size_t bytes = 0;          // bytes written to the terminal
+	double seconds = 0;        // wall time from first to last emitted frame
+};
+
+// Plays the source in the terminal through a decode -> resize -> map -> emit pipeline and returns its statistics
+StreamStats runStream(const StreamOptions& options, const Parameters& params);
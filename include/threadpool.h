@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed-size thread pool where every worker owns a task deque. Workers pop their own newest task first
+/// and steal the oldest task of another worker when they run dry, so uneven jobs still keep all cores busy.
+class ThreadPool {
+public:
+	// Starts the given number of workers, 0 -> one per hardware thread
+	explicit ThreadPool(unsigned int threads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Queues a task. Tasks submitted from inside a worker go to that worker's own deque.
+	void submit(std::function<void()> task);
+
+	// Blocks until every submitted task has finished
+	void wait();
+
+	unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	void workerLoop(unsigned int index);
+	bool popLocal(unsigned int index, std::function<void()>& task);
+	bool steal(unsigned int thief, std::function<void()>& task);
+
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex stateMutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+	std::size_t queued = 0;    // tasks sitting in some deque, guarded by stateMutex
+	std::size_t unfinished = 0; // tasks queued or running, guarded by stateMutex
+	std::atomic<unsigned int> nextQueue{0};
+	bool stopping = false;
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "asciirenderer.h"
+
+/// Character grid reduced from a source image, in the plane layout Renderer::render takes. In the sub-cell glyph
+/// modes it holds one value per sub-pixel, so width and height are multiples of the cell size.
+struct ReducedGrid {
+	int width = 0;
+	int height = 0;
+	std::vector<uint16_t> luma;  // 16-bit luminance quanta, one per cell
+	std::vector<uint8_t> rgb;    // mean 8-bit color of every cell as rgb triples
+};
+
+/// Uncompressed rows of 1 (gray) or 3 (rgb) interleaved channels, packed without padding:
+/// 8 bits per sample up to maxval 255, big-endian 16 bits above
+struct PixelLayout {
+	size_t width = 0;
+	size_t height = 0;
+	int channels = 0;
+	uint32_t maxval = 255;
+
+	size_t rowBytes() const { return width * channels * (maxval > 255 ? 2 : 1); }
+};
+
+// Parses the header of a binary PNM (P5 gray or P6 rgb) at the start of data into its layout and the offset of the
+// first sample. False if data holds no complete binary PNM.
+bool parsePnmHeader(const uint8_t* data, size_t size, PixelLayout& layout, size_t& dataOffset);
+
+// Area-averages an image held in memory down to the character grid chosen by fitTargetSize, filling in the target
+// size of params. Large images are split across params.threads workers.
+ReducedGrid reducePixels(Parameters& params, const uint8_t* pixels, const PixelLayout& layout);
+
+// Reduces params.in_filepath to the character grid without ever holding the full image, for inputs far larger than
+// memory. Every cell is the area average of its source pixels. Binary PNM (P5/P6) and the BMP variants of the
+// built-in decoder are memory-mapped and reduced in strips on parallel workers, anything else is streamed row by row
+// through ImageMagick. Fills in the target size of params; the grid never has more cells than the source has pixels.
+// memoryBudget caps the source bytes held at once, but never goes below one source row per worker.
+ReducedGrid reduceTiled(Parameters& params, size_t memoryBudget);
+
+// Pings params.in_filepath, sizes params with fitTargetSize and has ImageMagick decode it row by row into handler,
+// with whatever the coder caches beyond memoryBudget going to disk. Throws std::runtime_error with ImageMagick's
+// reason if decoding fails, or for formats whose coders deliver rows bottom-up (other BMP variants, ICO, TGA). Part
+// of the ImageMagick module.
+void streamImageRows(Parameters& params, size_t memoryBudget, MagickCore::StreamHandler handler);
@@ -0,0 +1,74 @@
+#include "profiler.h"
+
+#include <cerrno>
+#include <cstddef>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Feeds bytesAllocated. Only the programs link this file, never the library: replacing malloc decides the allocator
+// of the whole process, which is not the library's call to make for its host. Sanitizers bring their own malloc,
+// which the counting replacements below would bypass.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+namespace {
+	// Allocations are only counted while some thread profiles, so everything else pays one relaxed load per malloc
+	inline void countAllocation(size_t size) {
+		if (liveProfilers.load(std::memory_order_relaxed) > 0) {
+			allocatedTotal.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+		}
+	}
+}
+
+// glibc lets the program replace malloc and its relatives. Doing that catches every allocation of the process,
+// including ImageMagick's pixel buffers, which a C++ operator new hook would miss. The replacements only count the
+// requested size and forward to glibc's own allocator.
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* pointer, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void __libc_free(void* pointer);
+
+	void* malloc(size_t size) noexcept {
+		countAllocation(size);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t count, size_t size) noexcept {
+		countAllocation(count * size);
+		return __libc_calloc(count, size);
+	}
+
+	void* realloc(void* pointer, size_t size) noexcept {
+		// Only the growth is new memory, shrinking or resizing within the slack of the block allocates nothing
+		if (liveProfilers.load(std::memory_order_relaxed) > 0) {
+			const size_t usable = pointer != nullptr ? malloc_usable_size(pointer) : 0;
+			if (size > usable) countAllocation(size - usable);
+		}
+		return __libc_realloc(pointer, size);
+	}
+
+	void free(void* pointer) noexcept {
+		__libc_free(pointer);
+	}
+
+	void* memalign(size_t alignment, size_t size) noexcept {
+		countAllocation(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size) noexcept {
+		countAllocation(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	int posix_memalign(void** pointer, size_t alignment, size_t size) noexcept {
+		if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+		countAllocation(size);
+		void* block = __libc_memalign(alignment, size);
+		if (block == nullptr) return ENOMEM;
+		*pointer = block;
+		return 0;
+	}
+}
+#endif
@@ -0,0 +1,180 @@
+#include "ansiencoder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+	constexpr uint8_t CUBE_LEVELS[6] = {0, 95, 135, 175, 215, 255};
+
+	int cubeIndex(int v) {
+		if (v < 48) return 0;
+		if (v < 115) return 1;
+		return (v - 35) / 40;
+	}
+
+	int distanceSquared(int r1, int g1, int b1, int r2, int g2, int b2) {
+		return (r1 - r2) * (r1 - r2) + (g1 - g2) * (g1 - g2) + (b1 - b2) * (b1 - b2);
+	}
+
+	/// Appends 0-255 without going through a temporary string
+	void appendByte(std::string& out, uint32_t v) {
+		if (v >= 100) out += static_cast<char>('0' + v / 100);
+		if (v >= 10) out += static_cast<char>('0' + v / 10 % 10);
+		out += static_cast<char>('0' + v % 10);
+	}
+
+	bool isBlank(std::string_view glyph) {
+		return glyph == " ";
+	}
+
+	bool isFull(std::string_view glyph) {
+		return glyph == "█";
+	}
+}
+
+ColorMode parseColorMode(const std::string& name) {
+	if (name == "none") return ColorMode::None;
+	if (name == "truecolor") return ColorMode::TrueColor;
+	if (name == "256") return ColorMode::Palette256;
+	throw std::invalid_argument("Unknown color mode: " + name);
+}
+
+uint8_t toPalette256(uint8_t r, uint8_t g, uint8_t b) {
+	const int ri = cubeIndex(r), gi = cubeIndex(g), bi = cubeIndex(b);
+	const int cubeDistance = distanceSquared(r, g, b, CUBE_LEVELS[ri], CUBE_LEVELS[gi], CUBE_LEVELS[bi]);
+
+	// Gray ramp 232-255 covers 8, 18, ..., 238
+	const int average = (r + g + b) / 3;
+	const int grayIndex = std::clamp((average - 3) / 10, 0, 23);
+	const int gray = 8 + grayIndex * 10;
+	const int grayDistance = distanceSquared(r, g, b, gray, gray, gray);
+
+	if (grayDistance < cubeDistance) return static_cast<uint8_t>(232 + grayIndex);
+	return static_cast<uint8_t>(16 + 36 * ri + 6 * gi + bi);
+}
+
+AnsiEncoder::AnsiEncoder(ColorMode mode, int bitsPerChannel) : colorMode(mode) {
+	bitsPerChannel = std::clamp(bitsPerChannel, 1, 8);
+	keepMask = static_cast<uint8_t>(0xFF << (8 - bitsPerChannel));
+	roundingBit = bitsPerChannel == 8 ? 0 : static_cast<uint8_t>(1 << (7 - bitsPerChannel));
+}
+
+uint32_t AnsiEncoder::quantize(uint8_t r, uint8_t g, uint8_t b) const {
+	r = (r & keepMask) | roundingBit;
+	g = (g & keepMask) | roundingBit;
+	b = (b & keepMask) | roundingBit;
+	if (colorMode == ColorMode::Palette256) return toPalette256(r, g, b);
+	return (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | b;
+}
+
+void AnsiEncoder::appendEscape(std::string& out, uint32_t color, bool background) {
+	const size_t before = out.size();
+	out += background ? "\033[48;" : "\033[38;";
+	if (colorMode == ColorMode::Palette256) {
+		out += "5;";
+		appendByte(out, color);
+	} else {
+		out += "2;";
+		appendByte(out, color >> 16);
+		out += ';';
+		appendByte(out, (color >> 8) & 0xFF);
+		out += ';';
+		appendByte(out, color & 0xFF);
+	}
+	out += 'm';
+	counters.bytes += out.size() - before;
+	counters.sgrSequences++;
+	if (background) {
+		currentBackground = color;
+		haveBackground = true;
+	} else {
+		current = color;
+		haveColor = true;
+	}
+}
+
+void AnsiEncoder::appendCell(std::string& out, std::string_view glyph, uint32_t color) {
+	if (colorMode != ColorMode::None && (!haveColor || color != current) && !isBlank(glyph)) {
+		appendEscape(out, color);
+	}
+	out += glyph;
+	counters.bytes += glyph.size();
+	counters.cells++;
+}
+
+void AnsiEncoder::appendCell(std::string& out, std::string_view glyph, uint32_t foreground, uint32_t background) {
+	if (colorMode != ColorMode::None && foreground == background) {
+		// One color over the whole cell: a full block if that saves the escape, else the shorter space on the background
+		const bool backgroundSet = haveBackground && background == currentBackground;
+		glyph = !backgroundSet && haveColor && foreground == current ? "█" : " ";
+	}
+	if (colorMode != ColorMode::None && (!haveBackground || background != currentBackground) && !isFull(glyph)) {
+		appendEscape(out, background, true);
+	}
+	appendCell(out, glyph, foreground);
+}
+
+void AnsiEncoder::encodeGrid(std::string& out, const uint8_t* levels, const uint8_t* rgb, int width, int height, const GlyphTable& table) {
+	for (int j = 0; j < height; j++) {
+		for (int i = 0; i < width; i++) {
+			const size_t cell = static_cast<size_t>(j) * width + i;
+			const uint8_t level = levels[cell];
+			const std::string_view glyph(table.glyphs[level].data(), table.lengths[level]);
+			appendCell(out, glyph, quantize(rgb[cell * 3], rgb[cell * 3 + 1], rgb[cell * 3 + 2]));
+		}
+		out += '\n';
+		counters.bytes++;
+	}
+	if (colorMode != ColorMode::None) {
+		out += "\033[0m";
+		counters.bytes += 4;
+		haveColor = false;
+	}
+}
+
+void AnsiEncoder::encodeMaskGrid(std::string& out, const uint8_t* masks, const uint8_t* rgb, int width, int height, const MaskGlyphTable& table) {
+	const int cellsWide = width / table.columns;
+	const int cellsHigh = height / table.rows;
+	uint8_t foreground[3];
+	uint8_t background[3];
+	for (int j = 0; j < cellsHigh; j++) {
+		for (int i = 0; i < cellsWide; i++) {
+			const uint8_t mask = masks[static_cast<size_t>(j) * cellsWide + i];
+			const std::string_view glyph(table.glyphs[mask].data(), table.lengths[mask]);
+			splitCellColors(rgb, width, i, j, mask, table, foreground, background);
+			const uint32_t fg = quantize(foreground[0], foreground[1], foreground[2]);
+			if (table.fillsCell) {
+				appendCell(out, glyph, fg, quantize(background[0], background[1], background[2]));
+			} else {
+				appendCell(out, glyph, fg);
+			}
+		}
+		if (haveBackground) {
+			// Terminals paint lines opened by scrolling with the current background, so it must not cross the newline
+			out += "\033[49m";
+			counters.bytes += 5;
+			counters.sgrSequences++;
+			haveBackground = false;
+		}
+		out += '\n';
+		counters.bytes++;
+	}
+	if (colorMode != ColorMode::None) {
+		out += "\033[0m";
+		counters.bytes += 4;
+		haveColor = false;
+	}
+}
+
+void writeToStdout(std::string_view data) {
+	while (!data.empty()) {
+		const ssize_t written = ::write(STDOUT_FILENO, data.data(), data.size());
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			throw std::runtime_error("Could not write to stdout");
+		}
+		data.remove_prefix(static_cast<size_t>(written));
+	}
+}
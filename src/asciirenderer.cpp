@@ -1,105 +1,91 @@
 #include "asciirenderer.h"
 
-using namespace Magick; 
+#include "imagesource.h"
+#include "renderer.h"
 
-constexpr std::array<std::string_view, 256> makeLUT(bool inverted) {
-    std::array<std::string_view, 256> LUT{};
+constexpr auto LUT_BOW = makeLUT(true);   // black on white
+constexpr auto LUT_WOB = makeLUT(false);  // white on black
+
+constexpr auto GLYPHS_BOW = makeGlyphTable(LUT_BOW);
+constexpr auto GLYPHS_WOB = makeGlyphTable(LUT_WOB);
 
-    if (!inverted) {
-        for (int i = 0; i < 256; i++) {
-            if (i < 30)        LUT[i] = " ";
-            else if (i < 90)   LUT[i] = "░";
-            else if (i < 152)  LUT[i] = "▒";
-            else if (i < 219)  LUT[i] = "▓";
-            else               LUT[i] = "█";
-        }
-    } else {
-        for (int i = 0; i < 256; i++) {
-            if (i > 218)       LUT[i] = " ";
-            else if (i > 151)  LUT[i] = "░";
-            else if (i > 89)   LUT[i] = "▒";
-            else if (i > 29)   LUT[i] = "▓";
-            else               LUT[i] = "█";
-        }
-    }
+constexpr auto MASKS_HALF = makeMaskGlyphTable(GlyphMode::HalfBlock);
+constexpr auto MASKS_QUADRANT = makeMaskGlyphTable(GlyphMode::Quadrant);
+constexpr auto MASKS_BRAILLE = makeMaskGlyphTable(GlyphMode::Braille);
 
-    return LUT;
+const std::array<std::string_view, 256>& getLUT(bool inverted) {
+	return inverted ? LUT_BOW : LUT_WOB;
 }
 
-constexpr auto LUT_BOW = makeLUT(true);   // black on white
-constexpr auto LUT_WOB = makeLUT(false);  // white on black
+const GlyphTable& getGlyphTable(bool inverted) {
+	return inverted ? GLYPHS_BOW : GLYPHS_WOB;
+}
 
-std::string renderImage(Parameters params) {
-	std::array<std::string_view, 256> lut;
-	std::string art = "";
-	
-	if (!params.inverted) {
-		lut = LUT_WOB;
-	} else {
-		lut = LUT_BOW;
-	}
-	try {
-		// Get the image
-		Image input(params.in_filepath);
+const MaskGlyphTable& getMaskGlyphTable(GlyphMode mode) {
+	if (mode == GlyphMode::Braille) return MASKS_BRAILLE;
+	return mode == GlyphMode::Quadrant ? MASKS_QUADRANT : MASKS_HALF;
+}
 
-		int width = input.columns();
-		int height = input.rows();
-		art.reserve(width * (height + 1));
+namespace {
+	std::string magickPath;
+}
 
-		// Blur it to denoise it
-		input.gaussianBlur(0,1.0);
-		//input.write("step1blurred.png");
+void setMagickPath(const char* path) {
+	magickPath = path != nullptr ? path : "";
+}
 
-		// Calculate target size keeping aspect ratio in mind
-		if (params.target_width != 0) {
-			if (params.target_height != 0) {
-				// both width and height given → fit inside the given box, preserving aspect ratio
-				double aspect = static_cast<double>(width) / height;
-				double box_aspect = static_cast<double>(params.target_width) / (params.target_height * params.pixelRatio);
-				if (aspect > box_aspect) {
-					// image is wider than the box -> limit by width
-					params.target_height = height * (params.target_width / width) / params.pixelRatio;
-				} else {
-					// image is taller than the box -> limit by height
-					params.target_width = (width * params.target_height * params.pixelRatio) / height;
-				}
-			} else {
-				params.target_height = height * (params.target_width / width) / params.pixelRatio;
-			}
-		} else {
-			if (params.target_height == 0) {
-				params.target_width = 400;
+const std::string& getMagickPath() {
+	return magickPath;
+}
+
+void fitTargetSize(Parameters& params, int width, int height) {
+	if (params.target_width != 0) {
+		if (params.target_height != 0) {
+			// both width and height given → fit inside the given box, preserving aspect ratio
+			double aspect = static_cast<double>(width) / height;
+			double box_aspect = static_cast<double>(params.target_width) / (params.target_height * params.pixelRatio);
+			if (aspect > box_aspect) {
+				// image is wider than the box -> limit by width
 				params.target_height = height * (params.target_width / width) / params.pixelRatio;
 			} else {
+				// image is taller than the box -> limit by height
 				params.target_width = (width * params.target_height * params.pixelRatio) / height;
 			}
+		} else {
+			params.target_height = height * (params.target_width / width) / params.pixelRatio;
 		}
+	} else {
+		if (params.target_height == 0) {
+			params.target_width = 400;
+			params.target_height = height * (params.target_width / width) / params.pixelRatio;
+		} else {
+			params.target_width = (width * params.target_height * params.pixelRatio) / height;
+		}
+	}
+}
 
-		input.resize(Geometry(std::to_string(std::lround(params.target_width)) + "x" + std::to_string(std::lround(params.target_height)) + "!"));
-		
-		width = input.columns();
-		height = input.rows();
-
-		input.type(GrayscaleType);
-
-		// Create view of the pixel cache
-		Pixels view(input);
-
-		// Get a pointer to the pixel data
-		const PixelPacket* pixels = view.getConst(0, 0, input.columns(), input.rows());
+std::string decodeSizeHint(const Parameters& params) {
+	// A cell spans pixelRatio times its width in source pixels, or more rows than that if the mode samples more
+	const double rowsPerCell = std::max<double>(params.pixelRatio, subcellRows(params.glyphMode));
+	const long width = std::lround(params.target_width * subcellColumns(params.glyphMode) * 2);
+	const long height = std::lround(params.target_height * rowsPerCell * 2);
+	return std::to_string(width) + "x" + std::to_string(height);
+}
 
-		const double scale = 255.0 / QuantumRange;
-		for (int j = 0; j < height; j++) {
-			for (int i = 0; i < width; i++) {
-				const int brightness = static_cast<int>(pixels[j * width + i].red * scale);
-				art += lut[brightness];
-			}
-			art += '\n';
-		}
+std::string renderImageOrThrow(Parameters params) {
+	const ReducedGrid grid = openImageSource(params.in_filepath)->reduce(params);
+	Renderer renderer(params);
+	std::string art;
+	const uint8_t* rgb = params.cellColor != ColorMode::None ? grid.rgb.data() : nullptr;
+	if (!renderer.render(grid.luma.data(), rgb, grid.width, grid.height, art)) throw std::runtime_error(renderer.errorMessage());
+	return art;
+}
 
+std::string renderImage(Parameters params) {
+	try {
+		return renderImageOrThrow(std::move(params));
 	} catch (const std::exception& e) {
 		std::cerr << "Error reading / editing image: " << e.what() << std::endl;
 	}
-	
-	return art;
+	return "";
 }
\ No newline at end of file
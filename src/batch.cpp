@@ -0,0 +1,187 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include "threadpool.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+	constexpr std::array<std::string_view, 14> IMAGE_EXTENSIONS = {
+		".png", ".jpg", ".jpeg", ".gif", ".bmp", ".tif", ".tiff",
+		".webp", ".ppm", ".pgm", ".pnm", ".pbm", ".qoi", ".heic"
+	};
+
+	bool isImageFile(const fs::path& path) {
+		std::string ext = path.extension().string();
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+		return std::find(IMAGE_EXTENSIONS.begin(), IMAGE_EXTENSIONS.end(), ext) != IMAGE_EXTENSIONS.end();
+	}
+
+	bool hasWildcard(const std::string& s) {
+		return s.find_first_of("*?") != std::string::npos;
+	}
+
+	/// Matches '*' (any run) and '?' (any single character) against name
+	bool wildcardMatch(std::string_view pattern, std::string_view name) {
+		size_t p = 0, n = 0;
+		size_t star = std::string_view::npos, resume = 0;
+		while (n < name.size()) {
+			if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+				p++;
+				n++;
+			} else if (p < pattern.size() && pattern[p] == '*') {
+				star = p++;
+				resume = n;
+			} else if (star != std::string_view::npos) {
+				p = star + 1;
+				n = ++resume;
+			} else {
+				return false;
+			}
+		}
+		while (p < pattern.size() && pattern[p] == '*') p++;
+		return p == pattern.size();
+	}
+
+	/// Where the rendering of input goes: out_dir mirrors the layout of input below root. The source extension is
+	/// kept (a.png -> a.png.txt), so images that only differ in their format do not share an output.
+	fs::path mirroredOutput(const fs::path& out_dir, const fs::path& root, const fs::path& input) {
+		fs::path rel = root.empty() ? input.lexically_normal() : input.lexically_relative(root);
+		if (rel.empty() || rel.is_absolute() || *rel.begin() == "..") {
+			rel = fs::absolute(input).lexically_normal().relative_path();
+		}
+		rel += ".txt";
+		return out_dir / rel;
+	}
+}
+
+std::vector<fs::path> expandGlob(const std::string& pattern) {
+	const fs::path patternPath(pattern);
+	fs::path root = patternPath.parent_path();
+	if (hasWildcard(root.string())) {
+		throw std::invalid_argument("Wildcards are only supported in the last path component: " + pattern);
+	}
+	if (root.empty()) root = ".";
+
+	std::vector<fs::path> matches;
+	const std::string filePattern = patternPath.filename().string();
+	for (const auto& entry : fs::directory_iterator(root)) {
+		if (entry.is_regular_file() && wildcardMatch(filePattern, entry.path().filename().string())) {
+			matches.push_back(entry.path());
+		}
+	}
+	std::sort(matches.begin(), matches.end());
+	return matches;
+}
+
+std::vector<BatchItem> collectBatchItems(const BatchOptions& options) {
+	std::vector<BatchItem> items;
+
+	if (options.source == "-") {
+		// Newline-delimited manifest on stdin
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (line.empty()) continue;
+			fs::path input(line);
+			items.push_back({input, mirroredOutput(options.out_dir, {}, input)});
+		}
+	} else if (fs::is_directory(options.source)) {
+		const fs::path root(options.source);
+		for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied)) {
+			if (entry.is_regular_file() && isImageFile(entry.path())) {
+				items.push_back({entry.path(), mirroredOutput(options.out_dir, root, entry.path())});
+			}
+		}
+	} else if (hasWildcard(options.source)) {
+		fs::path root = fs::path(options.source).parent_path();
+		if (root.empty()) root = ".";
+		for (const fs::path& input : expandGlob(options.source)) {
+			items.push_back({input, mirroredOutput(options.out_dir, root, input)});
+		}
+	} else {
+		throw std::invalid_argument("Batch source is neither a directory, a glob pattern nor '-': " + options.source);
+	}
+
+	// Deterministic order makes runs comparable, the pool reorders the actual work anyway
+	std::sort(items.begin(), items.end(), [](const BatchItem& a, const BatchItem& b) { return a.input < b.input; });
+	return items;
+}
+
+int runBatch(const BatchOptions& options, const Parameters& params) {
+	const std::vector<BatchItem> items = collectBatchItems(options);
+	if (items.empty()) {
+		std::cerr << "Batch source matched no images: " << options.source << std::endl;
+		return 0;
+	}
+
+	// Parallelism comes from rendering many files at once, so keep ImageMagick from spawning its own threads per file.
+	// Initializing it first keeps its defaults from overriding the limit later.
+	ensureMagick();
+	Magick::ResourceLimits::thread(1);
+
+	std::mutex failureMutex;
+	std::vector<std::pair<fs::path, std::string>> failures;
+
+	const auto start = std::chrono::steady_clock::now();
+	{
+		ThreadPool pool(options.jobs);
+		// A manifest can still name one file twice, directly or through a relative and an absolute path, which mirror
+		// to different outputs. Only the first of them is rendered: inputs are compared by their canonical path, and
+		// outputs as they are so no two tasks ever write the same file at the same time.
+		std::map<fs::path, fs::path> inputOwners;
+		std::map<fs::path, fs::path> outputOwners;
+		for (const BatchItem& item : items) {
+			std::error_code error;
+			fs::path canonical = fs::weakly_canonical(item.input, error);
+			if (error) canonical = fs::absolute(item.input).lexically_normal();
+			const auto [first, firstName] = inputOwners.emplace(canonical, item.input);
+			if (!firstName) {
+				std::lock_guard<std::mutex> lock(failureMutex);
+				failures.emplace_back(item.input, "Same file as " + first->second.string());
+				continue;
+			}
+			const auto [owner, claimed] = outputOwners.emplace(item.output, item.input);
+			if (!claimed) {
+				std::lock_guard<std::mutex> lock(failureMutex);
+				failures.emplace_back(item.input, "Same output file as " + owner->second.string() + ": " + item.output.string());
+				continue;
+			}
+			pool.submit([&item, &params, &failureMutex, &failures] {
+				try {
+					Parameters fileParams = params;
+					fileParams.in_filepath = item.input.string();
+					fileParams.threads = 1;  // the pool already keeps every core busy
+					const std::string art = renderImageOrThrow(fileParams);
+
+					fs::create_directories(item.output.parent_path());
+					std::ofstream out(item.output, std::ios::binary);
+					if (!out) throw std::runtime_error("Could not open output file: " + item.output.string());
+					out << art;
+					if (!out) throw std::runtime_error("Could not write output file: " + item.output.string());
+				} catch (const std::exception& e) {
+					std::lock_guard<std::mutex> lock(failureMutex);
+					failures.emplace_back(item.input, e.what());
+				}
+			});
+		}
+		pool.wait();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::sort(failures.begin(), failures.end());
+	for (const auto& [path, message] : failures) {
+		std::cerr << "Failed: " << path.string() << ": " << message << std::endl;
+	}
+	std::cerr << "Rendered " << items.size() - failures.size() << "/" << items.size() << " images in "
+	          << elapsed.count() << "s (" << items.size() / elapsed.count() << " files/s)" << std::endl;
+
+	return static_cast<int>(failures.size());
+}
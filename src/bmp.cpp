@@ -0,0 +1,113 @@
+#include "bmp.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	constexpr size_t BMP_FILE_HEADER = 14;
+	constexpr size_t BMP_INFO_HEADER = 40;
+	constexpr uint32_t BMP_RGB = 0;
+	constexpr uint32_t BMP_BITFIELDS = 3;
+
+	uint16_t readLe16(const uint8_t* p) {
+		return static_cast<uint16_t>(p[0] | p[1] << 8);
+	}
+
+	uint32_t readLe32(const uint8_t* p) {
+		return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+	}
+}
+
+bool parseBmpHeader(const uint8_t* data, size_t size, BmpHeader& header) {
+	if (size < BMP_FILE_HEADER + BMP_INFO_HEADER || data[0] != 'B' || data[1] != 'M') return false;
+	header.dataOffset = readLe32(data + 10);
+	header.headerSize = readLe32(data + 14);
+	header.width = static_cast<int32_t>(readLe32(data + 18));
+	header.height = static_cast<int32_t>(readLe32(data + 22));
+	header.bitsPerPixel = readLe16(data + 28);
+	header.compression = readLe32(data + 30);
+	header.colorsUsed = readLe32(data + 46);
+	if (header.headerSize < BMP_INFO_HEADER || readLe16(data + 26) != 1) return false;
+	if (header.width <= 0 || header.height == 0 || header.height == INT32_MIN) return false;
+
+	switch (header.bitsPerPixel) {
+		case 1: case 4: case 8: case 24:
+			return header.compression == BMP_RGB;
+		case 16: case 32:
+			if (header.compression == BMP_BITFIELDS) {
+				// Right behind a plain info header, or inside the larger ones at the same offset
+				if (size < BMP_FILE_HEADER + BMP_INFO_HEADER + 12) return false;
+				for (int i = 0; i < 3; i++) header.masks[i] = readLe32(data + BMP_FILE_HEADER + BMP_INFO_HEADER + 4 * i);
+				return true;
+			}
+			if (header.compression != BMP_RGB) return false;
+			if (header.bitsPerPixel == 16) {
+				header.masks[0] = 0x7C00; header.masks[1] = 0x03E0; header.masks[2] = 0x001F;
+			} else {
+				header.masks[0] = 0xFF0000; header.masks[1] = 0xFF00; header.masks[2] = 0xFF;
+			}
+			return true;
+		default:
+			return false;
+	}
+}
+
+BmpRows::MaskChannel::MaskChannel(uint32_t mask) : mask(mask) {
+	if (mask == 0) return;
+	while (((mask >> shift) & 1) == 0) shift++;
+	maximum = mask >> shift;
+}
+
+BmpRows::BmpRows(const uint8_t* data, size_t size, const BmpHeader& header)
+	: data(data), header(header), columns(static_cast<size_t>(header.width)),
+	  rows(static_cast<size_t>(header.height < 0 ? -static_cast<int64_t>(header.height) : header.height)),
+	  rowStride((columns * header.bitsPerPixel + 31) / 32 * 4),
+	  red(header.masks[0]), green(header.masks[1]), blue(header.masks[2]) {
+	if (header.dataOffset > size || rowStride > (size - header.dataOffset) / rows) throw std::runtime_error("Truncated BMP");
+
+	if (header.bitsPerPixel <= 8) {
+		const size_t entries = std::min<size_t>(header.colorsUsed != 0 ? header.colorsUsed : 1u << header.bitsPerPixel, 256);
+		const size_t offset = BMP_FILE_HEADER + header.headerSize;
+		if (offset + entries * 4 > header.dataOffset) throw std::runtime_error("Truncated BMP palette");
+		for (size_t i = 0; i < entries; i++) {
+			// Stored as blue, green, red, reserved
+			palette[i][0] = data[offset + i * 4 + 2];
+			palette[i][1] = data[offset + i * 4 + 1];
+			palette[i][2] = data[offset + i * 4];
+		}
+	}
+}
+
+size_t BmpRows::rowOffset(size_t y) const {
+	// Positive heights store the bottom row first
+	return header.dataOffset + (header.height < 0 ? y : rows - 1 - y) * rowStride;
+}
+
+void BmpRows::decodeRow(size_t y, uint8_t* rgb) const {
+	const uint8_t* row = data + rowOffset(y);
+	for (size_t x = 0; x < columns; x++, rgb += 3) {
+		switch (header.bitsPerPixel) {
+			case 24:
+				rgb[0] = row[x * 3 + 2];
+				rgb[1] = row[x * 3 + 1];
+				rgb[2] = row[x * 3];
+				break;
+			case 16:
+			case 32: {
+				const uint32_t pixel = header.bitsPerPixel == 16 ? readLe16(row + x * 2) : readLe32(row + x * 4);
+				rgb[0] = red(pixel);
+				rgb[1] = green(pixel);
+				rgb[2] = blue(pixel);
+				break;
+			}
+			default: {
+				// Palette indices, packed most significant bits first
+				const size_t bit = x * header.bitsPerPixel;
+				const uint8_t index = (row[bit / 8] >> (8 - header.bitsPerPixel - bit % 8)) & ((1 << header.bitsPerPixel) - 1);
+				std::memcpy(rgb, palette[index], 3);
+				break;
+			}
+		}
+	}
+}
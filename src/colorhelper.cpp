@@ -1,6 +1,7 @@
+#include<algorithm>
 #include<colorhelper.h>
-
-using namespace Magick;
+#include<imagesource.h>
+#include<profiler.h>
 
 constexpr int clamp(int x, int min, int max) {
     return std::min(std::max(x, min), max);
@@ -26,55 +27,176 @@ std::tuple<int,int,int> makeForegroundColor(int r, int g, int b) {
     return {nr, ng, nb};
 }
 
+std::string makeAccentEscape(int r, int g, int b) {
+    auto [br, bg, bb] = makeBackgroundColor(r, g, b);
+    auto [fr, fg, fb] = makeForegroundColor(r, g, b);
+    return "\033[48;2;" + std::to_string(br) + ';' + std::to_string(bg) + ';' + std::to_string(bb) + "m"
+         + "\033[38;2;" + std::to_string(fr) + ';' + std::to_string(fg) + ';' + std::to_string(fb) + "m";
+}
+
 std::tuple<int,int,int> extractAccentColor(std::string filepath) {
 	try {
-		Image img(filepath);
-		// Downsize for speed and to smooth out noise
-		img.resize("100x100!");
-		img.gaussianBlur(0, 1.0);
+		Parameters params;
+		const ReducedGrid grid = openImageSource(filepath)->reduce(params);
+		return pickAccentColor(extractPalette(grid.rgb.data(), grid.luma.size()));
+	} catch (const std::exception& e) {
+		std::cerr << "Encountered an error trying to extract accent colors: " << e.what() << std::endl;
+		return {180, 180, 180};
+	}
+}
+
+namespace {
+	constexpr int HISTOGRAM_BITS = 5;
+	constexpr int HISTOGRAM_BINS = 1 << (3 * HISTOGRAM_BITS);
+	constexpr int KMEANS_ITERATIONS = 8;
+	// clusterBins stores the cluster of every bin in a byte
+	constexpr int MAX_CLUSTERS = 256;
 
-		// Quantize to 5 representative colors
-		img.quantizeColors(5);
-		img.quantize();
+	/// An occupied histogram bin: how many pixels fell into it and their mean color
+	struct ColorBin {
+		float r, g, b;
+		uint32_t count;
+	};
 
-		img.write("test-quantized.png");
+	float distance2(const ColorBin& a, const ColorBin& b) {
+		const float dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+		return dr * dr + dg * dg + db * db;
+	}
 
-		const size_t n = img.colorMapSize();
-		if (n == 0) {
-			throw std::runtime_error("Color map is empty after quantization.");
+	/// Reduces the pixels to the occupied bins of a 5-5-5 bit RGB histogram
+	std::vector<ColorBin> buildHistogram(const uint8_t* rgb, size_t pixels) {
+		// Bin keys first, in a loop the compiler can vectorize, then a plain scatter of counts and sums
+		std::vector<uint16_t> keys(pixels);
+		for (size_t i = 0; i < pixels; i++) {
+			const uint8_t* p = rgb + i * 3;
+			keys[i] = static_cast<uint16_t>((p[0] >> 3) << 10 | (p[1] >> 3) << 5 | p[2] >> 3);
 		}
 
-		double bestScore = -1.0;
-		int bestR = 128, bestG = 128, bestB = 128;
+		struct Sum { uint32_t r, g, b, count; };
+		std::vector<Sum> sums(HISTOGRAM_BINS);
+		for (size_t i = 0; i < pixels; i++) {
+			const uint8_t* p = rgb + i * 3;
+			Sum& sum = sums[keys[i]];
+			sum.r += p[0];
+			sum.g += p[1];
+			sum.b += p[2];
+			sum.count++;
+		}
 
-		for (size_t i = 0; i < n; ++i) {
-			Color c = img.colorMap(i);
+		std::vector<ColorBin> bins;
+		for (const Sum& sum : sums) {
+			if (sum.count == 0) continue;
+			const float inverse = 1.0f / sum.count;
+			bins.push_back({sum.r * inverse, sum.g * inverse, sum.b * inverse, sum.count});
+		}
+		return bins;
+	}
 
-			// Convert to 0–255 range
-			double r = c.redQuantum()   * 255.0 / QuantumRange;
-			double g = c.greenQuantum() * 255.0 / QuantumRange;
-			double b = c.blueQuantum()  * 255.0 / QuantumRange;
+	/// Weighted k-means over the bins, seeded deterministically with the most common bin and then
+	/// the bins that are far from every chosen center and hold many pixels
+	std::vector<ColorBin> clusterBins(const std::vector<ColorBin>& bins, int count) {
+		std::vector<ColorBin> centers;
+		if (bins.empty() || count <= 0) return centers;
 
-			// Compute brightness and saturation
-			double maxc = std::max({r, g, b});
-			double minc = std::min({r, g, b});
-			double saturation = (maxc == 0.0) ? 0.0 : (maxc - minc) / maxc;
-			double brightness = (r + g + b) / (3.0 * 255.0);
+		centers.push_back(*std::max_element(bins.begin(), bins.end(),
+			[](const ColorBin& a, const ColorBin& b) { return a.count < b.count; }));
+		std::vector<float> nearest(bins.size());
+		for (size_t i = 0; i < bins.size(); i++) nearest[i] = distance2(bins[i], centers[0]);
+		while (static_cast<int>(centers.size()) < count) {
+			size_t best = 0;
+			float bestWeight = 0;
+			for (size_t i = 0; i < bins.size(); i++) {
+				const float weight = nearest[i] * bins[i].count;
+				if (weight > bestWeight) {
+					bestWeight = weight;
+					best = i;
+				}
+			}
+			if (bestWeight == 0) break;  // fewer distinct colors than requested
+			centers.push_back(bins[best]);
+			for (size_t i = 0; i < bins.size(); i++) nearest[i] = std::min(nearest[i], distance2(bins[i], bins[best]));
+		}
 
-			// Score vibrant colors higher, avoid dark grays
-			double score = saturation * (0.4 + brightness);
+		std::vector<uint8_t> assignment(bins.size(), 0);
+		for (int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+			bool changed = iteration == 0;
+			for (size_t i = 0; i < bins.size(); i++) {
+				uint8_t closest = 0;
+				float closestDistance = distance2(bins[i], centers[0]);
+				for (size_t c = 1; c < centers.size(); c++) {
+					const float d = distance2(bins[i], centers[c]);
+					if (d < closestDistance) {
+						closestDistance = d;
+						closest = static_cast<uint8_t>(c);
+					}
+				}
+				changed |= assignment[i] != closest;
+				assignment[i] = closest;
+			}
+			if (!changed) break;
 
-			if (score > bestScore) {
-				bestScore = score;
-				bestR = static_cast<int>(r);
-				bestG = static_cast<int>(g);
-				bestB = static_cast<int>(b);
+			std::vector<double> sums(centers.size() * 4, 0.0);
+			for (size_t i = 0; i < bins.size(); i++) {
+				double* sum = &sums[assignment[i] * 4];
+				sum[0] += static_cast<double>(bins[i].r) * bins[i].count;
+				sum[1] += static_cast<double>(bins[i].g) * bins[i].count;
+				sum[2] += static_cast<double>(bins[i].b) * bins[i].count;
+				sum[3] += bins[i].count;
+			}
+			for (size_t c = 0; c < centers.size(); c++) {
+				const double* sum = &sums[c * 4];
+				if (sum[3] == 0) continue;  // keeps its old position, dropped below if it stays empty
+				centers[c] = {static_cast<float>(sum[0] / sum[3]), static_cast<float>(sum[1] / sum[3]),
+				              static_cast<float>(sum[2] / sum[3]), static_cast<uint32_t>(sum[3])};
 			}
 		}
 
-		return {bestR, bestG, bestB};
-	} catch (Exception e) {
-		std::cerr << "Encountered an error trying to extract accent colors: " << e.what() << std::endl;
-		return {180, 180, 180};
+		// Final populations, an iteration cap can leave the counts of the last update stale
+		for (ColorBin& center : centers) center.count = 0;
+		for (size_t i = 0; i < bins.size(); i++) centers[assignment[i]].count += bins[i].count;
+		centers.erase(std::remove_if(centers.begin(), centers.end(), [](const ColorBin& c) { return c.count == 0; }), centers.end());
+		return centers;
+	}
+}
+
+std::vector<PaletteColor> extractPalette(const uint8_t* rgb, size_t pixels, int count) {
+	std::vector<PaletteColor> palette;
+	if (pixels == 0) return palette;
+
+	const std::vector<ColorBin> centers = clusterBins(buildHistogram(rgb, pixels), std::min(count, MAX_CLUSTERS));
+	for (const ColorBin& center : centers) {
+		palette.push_back({clamp(static_cast<int>(center.r + 0.5f), 0, 255), clamp(static_cast<int>(center.g + 0.5f), 0, 255),
+		                   clamp(static_cast<int>(center.b + 0.5f), 0, 255), static_cast<double>(center.count) / pixels});
 	}
+	std::sort(palette.begin(), palette.end(), [](const PaletteColor& a, const PaletteColor& b) { return a.share > b.share; });
+	return palette;
+}
+
+std::tuple<int,int,int> pickAccentColor(const std::vector<PaletteColor>& palette) {
+	double bestScore = -1.0;
+	int bestR = 128, bestG = 128, bestB = 128;
+
+	for (const PaletteColor& c : palette) {
+		double r = c.r;
+		double g = c.g;
+		double b = c.b;
+
+		// Compute brightness and saturation
+		double maxc = std::max({r, g, b});
+		double minc = std::min({r, g, b});
+		double saturation = (maxc == 0.0) ? 0.0 : (maxc - minc) / maxc;
+		double brightness = (r + g + b) / (3.0 * 255.0);
+
+		// Score vibrant colors higher, avoid dark grays
+		double score = saturation * (0.4 + brightness);
+
+		if (score > bestScore) {
+			bestScore = score;
+			bestR = c.r;
+			bestG = c.g;
+			bestB = c.b;
+		}
+	}
+
+	return {bestR, bestG, bestB};
 }
\ No newline at end of file
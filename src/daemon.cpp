@@ -0,0 +1,420 @@
+#include "daemon.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "colorhelper.h"
+#include "renderer.h"
+#include "resultcache.h"
+#include "threadpool.h"
+
+using namespace Magick;
+
+namespace {
+	constexpr size_t MAX_REQUEST_LINE = 64 * 1024;
+	constexpr size_t MAX_INLINE_BYTES = 256u << 20;
+	constexpr size_t LATENCY_SAMPLES = 4096;
+	constexpr int ACCEPT_POLL_MS = 200;
+
+	std::atomic<bool> stopRequested{false};
+
+	void requestStop(int) {
+		stopRequested = true;
+	}
+
+	/// Keeps the latency of the most recent requests for percentile queries
+	class LatencyRecorder {
+	public:
+		void record(double micros) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (samples.size() < LATENCY_SAMPLES) {
+				samples.push_back(micros);
+			} else {
+				samples[next] = micros;
+			}
+			next = (next + 1) % LATENCY_SAMPLES;
+		}
+
+		// Returns the p-th percentile (0-1) of the recorded latencies in microseconds, 0 without samples
+		double percentile(double p) const {
+			std::vector<double> sorted;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				sorted = samples;
+			}
+			if (sorted.empty()) return 0;
+			const size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			return sorted[rank];
+		}
+
+	private:
+		mutable std::mutex mutex;
+		std::vector<double> samples;
+		size_t next = 0;
+	};
+
+	/// Connection state owned by the event loop. Requests of one connection are answered in order, so at most one
+	/// of them is on the pool at a time; the others wait in the buffer or in the socket.
+	struct Client {
+		std::string buffer;   // received bytes not yet taken as a request
+		bool busy = false;    // a request of this connection is being answered
+		bool hungUp = false;  // the peer closed its end, buffered requests are still answered
+	};
+
+	// Receives what is available without blocking, false on EOF or error
+	bool receiveAvailable(int fd, std::string& buffer) {
+		char chunk[64 * 1024];
+		while (true) {
+			const ssize_t received = ::recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+			if (received > 0) {
+				buffer.append(chunk, static_cast<size_t>(received));
+				return true;
+			}
+			if (received < 0 && errno == EINTR) continue;
+			return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+	}
+
+	bool sendAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			const ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+			if (sent < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
+			data.remove_prefix(static_cast<size_t>(sent));
+		}
+		return true;
+	}
+
+	/// One parsed RENDER request
+	struct RenderRequest {
+		Parameters params;
+		bool accent = false;
+		std::string path;
+		size_t inlineBytes = 0;
+		bool hasInline = false;
+	};
+
+	// Digits only, so the daemon and takeRequest never disagree about where the payload ends
+	bool parseByteCount(const std::string& value, size_t& count) {
+		if (value.empty() || value.size() > 19 || value.find_first_not_of("0123456789") != std::string::npos) return false;
+		count = std::stoull(value);
+		return true;
+	}
+
+	RenderRequest parseRender(const std::string& line, const Parameters& defaults) {
+		RenderRequest request;
+		request.params = defaults;
+		request.params.out_filepath.reset();
+		request.params.print = false;
+		request.params.threads = 1;  // the worker pool already keeps every core busy
+
+		double squish = defaults.squishfactor;
+		size_t pos = line.find(' ');
+		while (pos != std::string::npos) {
+			const size_t start = pos + 1;
+			if (line.compare(start, 5, "path=") == 0) {
+				// The path takes the rest of the line, so it may contain spaces
+				request.path = line.substr(start + 5);
+				break;
+			}
+			pos = line.find(' ', start);
+			const std::string token = line.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+			if (token.empty()) continue;
+
+			const size_t eq = token.find('=');
+			if (eq == std::string::npos) throw std::invalid_argument("Expected key=value, got " + token);
+			const std::string key = token.substr(0, eq);
+			const std::string value = token.substr(eq + 1);
+
+			if (key == "width") request.params.target_width = std::stoi(value);
+			else if (key == "height") request.params.target_height = std::stoi(value);
+			else if (key == "squish") squish = std::stod(value);
+			else if (key == "invert") request.params.inverted = value == "1";
+			else if (key == "colorbits") request.params.colorBits = std::stoi(value);
+			else if (key == "glyphs") request.params.glyphMode = parseGlyphMode(value);
+			else if (key == "bytes") {
+				if (!parseByteCount(value, request.inlineBytes)) throw std::invalid_argument("Invalid byte count: " + value);
+				request.hasInline = true;
+			} else if (key == "color") {
+				// accent and the 1 / 0 shorthands exist only here, the cell color modes are named as on the command line
+				request.accent = value == "accent" || value == "1";
+				request.params.cellColor = request.accent || value == "0" ? ColorMode::None : parseColorMode(value);
+			} else {
+				throw std::invalid_argument("Unknown key: " + key);
+			}
+		}
+
+		// Squish is relative to the terminal's pixel ratio, same as on the command line
+		request.params.pixelRatio = request.params.pixelRatio / defaults.squishfactor * squish;
+		request.params.squishfactor = squish;
+
+		if (request.hasInline == !request.path.empty()) throw std::invalid_argument("Expected exactly one of path= and bytes=");
+		if (request.inlineBytes > MAX_INLINE_BYTES) throw std::invalid_argument("Inline image too large");
+		return request;
+	}
+
+	/// Cache key: content hash and size plus every parameter that changes the output, in a fixed order
+	std::string cacheKey(const std::string& content, const RenderRequest& request) {
+		const Parameters& p = request.params;
+		std::ostringstream key;
+		key << std::hex << contentHash(content) << std::dec << ':' << content.size()
+		    << "|w=" << p.target_width << ";h=" << p.target_height << ";r=" << p.pixelRatio
+		    << ";i=" << p.inverted << ";a=" << request.accent
+		    << ";c=" << static_cast<int>(p.cellColor) << ";b=" << (p.cellColor == ColorMode::None ? 0 : p.colorBits)
+		    << ";g=" << static_cast<int>(p.glyphMode);
+		return key.str();
+	}
+
+	std::string renderRequest(const std::string& content, const RenderRequest& request) {
+		Parameters params = request.params;
+		const Blob blob(content.data(), content.size());
+		const Image reduced = decodeForRender(params, blob);
+
+		Renderer renderer(params);
+		std::string art;
+		if (!renderer.render(reduced, art)) throw std::runtime_error(renderer.errorMessage());
+
+		if (request.accent && params.cellColor == ColorMode::None) {
+			auto [r, g, b] = extractAccentColor(reduced);
+			art = makeAccentEscape(r, g, b) + art + "\033[0m";
+		}
+		return art;
+	}
+
+	std::string errorAnswer(const std::string& message) {
+		std::string flat = message;
+		std::replace(flat.begin(), flat.end(), '\n', ' ');
+		return "ERR " + flat + "\n";
+	}
+
+	bool isRenderLine(std::string_view line) {
+		return line.compare(0, 6, "RENDER") == 0 && (line.size() == 6 || line[6] == ' ');
+	}
+
+	/// Length of the inline image a RENDER line announces with bytes=, 0 without one. Read apart from parseRender so
+	/// the payload is skipped even when the rest of the line is invalid. False if the length is unreadable or over
+	/// MAX_INLINE_BYTES, where the stream cannot be resynchronized.
+	bool inlineLength(const std::string& line, size_t& length) {
+		length = 0;
+		size_t pos = line.find(' ');
+		while (pos != std::string::npos) {
+			const size_t start = pos + 1;
+			if (line.compare(start, 5, "path=") == 0) break;
+			pos = line.find(' ', start);
+			if (line.compare(start, 6, "bytes=") != 0) continue;
+			const size_t end = pos == std::string::npos ? line.size() : pos;
+			if (!parseByteCount(line.substr(start + 6, end - start - 6), length)) return false;
+		}
+		return length <= MAX_INLINE_BYTES;
+	}
+
+	enum class Take {
+		Complete,    // line and content hold the next request
+		Incomplete,  // more bytes are needed
+		Invalid      // the line is longer than any request may be or its payload cannot be skipped, the connection is dropped
+	};
+
+	// Moves the next complete request out of buffer: its line and, for RENDER bytes=N, the N bytes that follow it
+	Take takeRequest(std::string& buffer, std::string& line, std::string& content) {
+		const size_t newline = buffer.find('\n');
+		if (newline == std::string::npos) return buffer.size() > MAX_REQUEST_LINE ? Take::Invalid : Take::Incomplete;
+
+		std::string candidate = buffer.substr(0, newline);
+		if (!candidate.empty() && candidate.back() == '\r') candidate.pop_back();
+		// The payload is taken even if the rest of the line is invalid, which is answered once the request runs
+		size_t inlineBytes = 0;
+		if (isRenderLine(candidate) && !inlineLength(candidate, inlineBytes)) return Take::Invalid;
+		if (buffer.size() - newline - 1 < inlineBytes) return Take::Incomplete;
+
+		line = std::move(candidate);
+		content.assign(buffer, newline + 1, inlineBytes);
+		buffer.erase(0, newline + 1 + inlineBytes);
+		return Take::Complete;
+	}
+
+	/// Answers one request taken by takeRequest, content is its inline image if it has one
+	std::string answerRequest(const std::string& line, const std::string& content, const Parameters& defaults,
+	                          ResultCache& cache, LatencyRecorder& latency, std::chrono::steady_clock::time_point start) {
+		if (line == "STATS") {
+			std::ostringstream stats;
+			stats << "hits=" << cache.hits() << "\nmisses=" << cache.misses()
+			      << "\nentries=" << cache.entries() << "\ncache_bytes=" << cache.bytes()
+			      << "\np50_us=" << latency.percentile(0.50) << "\np99_us=" << latency.percentile(0.99) << "\n";
+			const std::string payload = stats.str();
+			return "OK " + std::to_string(payload.size()) + "\n" + payload;
+		}
+		if (!isRenderLine(line)) return errorAnswer("Unknown command");
+
+		std::shared_ptr<const std::string> art;
+		bool hit = false;
+		try {
+			const RenderRequest request = parseRender(line, defaults);
+			std::string fileContent;
+			if (!request.hasInline) {
+				std::ifstream in(request.path, std::ios::binary);
+				if (!in) throw std::runtime_error("Could not open " + request.path);
+				fileContent.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			}
+			const std::string& image = request.hasInline ? content : fileContent;
+
+			const std::string key = cacheKey(image, request);
+			art = cache.get(key);
+			hit = art != nullptr;
+			if (!hit) {
+				art = std::make_shared<const std::string>(renderRequest(image, request));
+				cache.put(key, art);
+			}
+		} catch (const std::exception& e) {
+			return errorAnswer(e.what());
+		}
+
+		latency.record(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		return "OK " + std::to_string(art->size()) + (hit ? " hit\n" : " miss\n") + *art;
+	}
+
+	int listenOn(const std::string& path) {
+		sockaddr_un address{};
+		if (path.size() >= sizeof(address.sun_path)) throw std::invalid_argument("Socket path too long: " + path);
+		address.sun_family = AF_UNIX;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) throw std::runtime_error("Could not create socket: " + std::string(std::strerror(errno)));
+		::unlink(path.c_str());
+		if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+			const std::string error = std::strerror(errno);
+			::close(fd);
+			throw std::runtime_error("Could not listen on " + path + ": " + error);
+		}
+		return fd;
+	}
+}
+
+int runDaemon(const DaemonOptions& options, const Parameters& params) {
+	const int listener = listenOn(options.socket_path);
+
+	// Requests are rendered in parallel, so keep ImageMagick from spawning its own threads per request
+	ensureMagick();
+	ResourceLimits::thread(1);
+
+	stopRequested = false;
+	struct sigaction action{};
+	action.sa_handler = requestStop;
+	sigemptyset(&action.sa_mask);
+	struct sigaction previousInt{}, previousTerm{};
+	sigaction(SIGINT, &action, &previousInt);
+	sigaction(SIGTERM, &action, &previousTerm);
+
+	ResultCache cache(options.cache_bytes);
+	LatencyRecorder latency;
+
+	// Workers report answered requests through finished and wake the event loop through the pipe
+	int wake[2];
+	if (::pipe2(wake, O_CLOEXEC | O_NONBLOCK) < 0) throw std::runtime_error("Could not create pipe: " + std::string(std::strerror(errno)));
+	std::mutex finishedMutex;
+	std::vector<std::pair<int, bool>> finished;  // connection and whether its answer was sent
+	std::map<int, Client> clients;
+
+	std::cerr << "Listening on " << options.socket_path << std::endl;
+	{
+		ThreadPool pool(options.jobs);
+
+		// Only complete requests go to the pool, so idle connections never hold a worker. False if the connection
+		// has to be closed.
+		auto dispatch = [&](int fd, Client& client) {
+			std::string line, content;
+			const Take taken = takeRequest(client.buffer, line, content);
+			if (taken == Take::Invalid) return false;
+			if (taken == Take::Incomplete) return !client.hungUp;
+
+			client.busy = true;
+			const auto start = std::chrono::steady_clock::now();
+			pool.submit([fd, line = std::move(line), content = std::move(content), start, &params, &cache, &latency,
+			             &finishedMutex, &finished, &wake] {
+				const bool sent = sendAll(fd, answerRequest(line, content, params, cache, latency, start));
+				{
+					std::lock_guard<std::mutex> lock(finishedMutex);
+					finished.emplace_back(fd, sent);
+				}
+				const char byte = 0;
+				(void)!::write(wake[1], &byte, 1);
+			});
+			return true;
+		};
+		auto disconnect = [&](int fd) {
+			clients.erase(fd);
+			::close(fd);
+		};
+
+		std::vector<pollfd> waiting;
+		while (!stopRequested) {
+			waiting.assign({pollfd{listener, POLLIN, 0}, pollfd{wake[0], POLLIN, 0}});
+			for (const auto& [fd, client] : clients) {
+				if (!client.busy && !client.hungUp) waiting.push_back(pollfd{fd, POLLIN, 0});
+			}
+			if (::poll(waiting.data(), waiting.size(), ACCEPT_POLL_MS) <= 0) continue;
+
+			if (waiting[0].revents & POLLIN) {
+				const int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+				if (client >= 0) clients.emplace(client, Client{});
+			}
+
+			if (waiting[1].revents & POLLIN) {
+				char drain[256];
+				while (::read(wake[0], drain, sizeof(drain)) > 0) {}
+				std::vector<std::pair<int, bool>> done;
+				{
+					std::lock_guard<std::mutex> lock(finishedMutex);
+					done.swap(finished);
+				}
+				// The next request may already be buffered, pipelined behind the one just answered
+				for (const auto& [fd, sent] : done) {
+					Client& client = clients.at(fd);
+					client.busy = false;
+					if (!sent || !dispatch(fd, client)) disconnect(fd);
+				}
+			}
+
+			for (size_t i = 2; i < waiting.size(); i++) {
+				if (waiting[i].revents == 0) continue;
+				const int fd = waiting[i].fd;
+				Client& client = clients.at(fd);
+				if (!receiveAvailable(fd, client.buffer)) client.hungUp = true;
+				if (!dispatch(fd, client)) disconnect(fd);
+			}
+		}
+
+		// Unblock answers still being sent to clients that stopped reading, so the pool can drain
+		for (const auto& [fd, client] : clients) {
+			if (client.busy) ::shutdown(fd, SHUT_RDWR);
+		}
+		pool.wait();
+	}
+	for (const auto& [fd, client] : clients) ::close(fd);
+	::close(wake[0]);
+	::close(wake[1]);
+
+	::close(listener);
+	::unlink(options.socket_path.c_str());
+	sigaction(SIGINT, &previousInt, nullptr);
+	sigaction(SIGTERM, &previousTerm, nullptr);
+
+	std::cerr << "Served " << cache.hits() + cache.misses() << " renders (" << cache.hits() << " cache hits)" << std::endl;
+	return 0;
+}
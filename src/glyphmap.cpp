@@ -0,0 +1,320 @@
+#include "glyphmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+	// Below this many cells the thread start-up costs more than the mapping itself
+	constexpr size_t MIN_CELLS_PER_THREAD = 1 << 16;
+
+	void quantizeScalar(const uint16_t* luma, size_t count, const GlyphTable& table, uint8_t* levels) {
+		const size_t thresholds = table.levels - 1;
+		for (size_t i = 0; i < count; i++) {
+			uint8_t level = 0;
+			for (size_t t = 0; t < thresholds; t++) {
+				level += luma[i] >= table.thresholds[t];
+			}
+			levels[i] = level;
+		}
+	}
+
+	/// Stores the byte length of each of the rows [rowBegin, rowEnd) of already quantized levels in rowOffsets
+	template <typename Table>
+	void measureRows(int width, int rowBegin, int rowEnd, const Table& table, GlyphMapScratch& scratch) {
+		for (int j = rowBegin; j < rowEnd; j++) {
+			const uint8_t* row = scratch.levels.data() + static_cast<size_t>(j) * width;
+			size_t bytes = 1;  // newline
+			for (int i = 0; i < width; i++) bytes += table.lengths[row[i]];
+			scratch.rowOffsets[j + 1] = bytes;
+		}
+	}
+
+	/// Quantizes and measures the rows [rowBegin, rowEnd), storing the byte length of each row in rowOffsets
+	void measureBand(const uint16_t* luma, int width, int rowBegin, int rowEnd, const GlyphTable& table, GlyphMapScratch& scratch) {
+		const size_t offset = static_cast<size_t>(rowBegin) * width;
+		quantizeLevels(luma + offset, static_cast<size_t>(rowEnd - rowBegin) * width, table, scratch.levels.data() + offset);
+		measureRows(width, rowBegin, rowEnd, table, scratch);
+	}
+
+	/// Writes the rows [rowBegin, rowEnd) at their precomputed offsets
+	template <typename Table>
+	void emitBand(int width, int rowBegin, int rowEnd, const Table& table, const GlyphMapScratch& scratch, char* out) {
+		for (int j = rowBegin; j < rowEnd; j++) {
+			const uint8_t* row = scratch.levels.data() + static_cast<size_t>(j) * width;
+			char* dst = out + scratch.rowOffsets[j];
+			// A padded store overshoots by up to 3 bytes, which the two cells and newline after it always cover
+			const int padded = std::max(0, width - 2);
+			int i = 0;
+			for (; i < padded; i++) {
+				// Fixed 4-byte store, advance by the real length: the next glyph overwrites the padding
+				std::memcpy(dst, table.glyphs[row[i]].data(), 4);
+				dst += table.lengths[row[i]];
+			}
+			// Exact copies at the end of the row, so nothing spills into a row another band is writing
+			for (; i < width; i++) {
+				std::memcpy(dst, table.glyphs[row[i]].data(), table.lengths[row[i]]);
+				dst += table.lengths[row[i]];
+			}
+			*dst = '\n';
+		}
+	}
+
+	template <typename Band>
+	void forEachBand(int height, unsigned int threads, Band band) {
+		if (threads <= 1) {
+			band(0, height);
+			return;
+		}
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		const int rowsPerBand = (height + threads - 1) / threads;
+		for (unsigned int t = 1; t < threads; t++) {
+			const int begin = std::min(height, static_cast<int>(t) * rowsPerBand);
+			const int end = std::min(height, begin + rowsPerBand);
+			if (begin < end) workers.emplace_back(band, begin, end);
+		}
+		band(0, std::min(height, rowsPerBand));
+		for (auto& worker : workers) worker.join();
+	}
+
+	// Below this spread between the darkest and brightest sub-pixel a cell counts as flat
+	constexpr uint16_t MIN_CELL_CONTRAST = 8192;
+	constexpr uint16_t FLAT_THRESHOLD = 32768;
+
+	/// Threshold of every cell in the cell rows [rowBegin, rowEnd): the mean of its sub-pixels, or mid-gray if it is flat
+	template <int Columns, int Rows>
+	void cellThresholds(const uint16_t* luma, int width, int rowBegin, int rowEnd, uint16_t* thresholds) {
+		const int cellsWide = width / Columns;
+		for (int j = rowBegin; j < rowEnd; j++) {
+			const uint16_t* top = luma + static_cast<size_t>(j) * Rows * width;
+			for (int i = 0; i < cellsWide; i++) {
+				uint32_t sum = 0;
+				uint16_t low = 0xFFFF, high = 0;
+				for (int r = 0; r < Rows; r++) {
+					const uint16_t* q = top + static_cast<size_t>(r) * width + i * Columns;
+					for (int c = 0; c < Columns; c++) {
+						sum += q[c];
+						low = std::min(low, q[c]);
+						high = std::max(high, q[c]);
+					}
+				}
+				// Noisy sources make the contrast test a coin flip, so select without a branch
+				const uint32_t flat = high - low < MIN_CELL_CONTRAST;
+				const uint32_t mean = sum / (Columns * Rows);
+				thresholds[static_cast<size_t>(j) * cellsWide + i] = static_cast<uint16_t>(mean + flat * (FLAT_THRESHOLD - mean));
+			}
+		}
+	}
+
+#if defined(__SSE2__)
+	/// Compares 8 consecutive sub-pixels of one row against the thresholds of their cells and returns one bit per
+	/// sub-pixel, set if brighter. Columns is 1 (8 cells) or 2 (4 cells, each threshold used for a pair).
+	template <int Columns>
+	inline uint32_t compareSubpixels(const uint16_t* row, const uint16_t* thresholds) {
+		// Same sign bias as quantizeLevels, SSE2 only has signed 16-bit compares
+		const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+		const __m128i q = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row)), bias);
+		__m128i t;
+		if (Columns == 1) {
+			t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(thresholds));
+		} else {
+			const __m128i four = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(thresholds));
+			t = _mm_unpacklo_epi16(four, four);
+		}
+		const __m128i brighter = _mm_cmpgt_epi16(q, _mm_xor_si128(t, bias));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(brighter, brighter))) & 0xFF;
+	}
+#endif
+
+	/// Sub-pixel masks of the cell rows [rowBegin, rowEnd), thresholds already computed
+	template <int Columns, int Rows>
+	void maskRows(const uint16_t* luma, int width, int rowBegin, int rowEnd, bool inverted, const uint16_t* thresholds,
+	              uint8_t* masks) {
+		const int cellsWide = width / Columns;
+		// Inverting flips every bit of the mask, brighter becomes not brighter
+		const uint8_t flip = inverted ? static_cast<uint8_t>((1u << (Columns * Rows)) - 1) : 0;
+
+		for (int j = rowBegin; j < rowEnd; j++) {
+			const uint16_t* top = luma + static_cast<size_t>(j) * Rows * width;
+			const uint16_t* limits = thresholds + static_cast<size_t>(j) * cellsWide;
+			uint8_t* cells = masks + static_cast<size_t>(j) * cellsWide;
+			int i = 0;
+
+#if defined(__SSE2__)
+			// One compare covers 8 sub-pixels of a row; its bit pairs (or single bits) are shifted into place per cell
+			constexpr int cellsPerVector = 8 / Columns;
+			for (; i + cellsPerVector <= cellsWide; i += cellsPerVector) {
+				uint32_t rowBits[Rows];
+				for (int r = 0; r < Rows; r++) {
+					rowBits[r] = compareSubpixels<Columns>(top + static_cast<size_t>(r) * width + i * Columns, limits + i);
+				}
+				constexpr uint32_t cellBits = (1u << Columns) - 1;
+				for (int k = 0; k < cellsPerVector; k++) {
+					uint32_t mask = 0;
+					for (int r = 0; r < Rows; r++) mask |= (rowBits[r] >> (k * Columns) & cellBits) << (r * Columns);
+					cells[i + k] = static_cast<uint8_t>(mask) ^ flip;
+				}
+			}
+#endif
+
+			for (; i < cellsWide; i++) {
+				uint32_t mask = 0;
+				for (int r = 0; r < Rows; r++) {
+					const uint16_t* q = top + static_cast<size_t>(r) * width + i * Columns;
+					for (int c = 0; c < Columns; c++) mask |= static_cast<uint32_t>(q[c] > limits[i]) << (r * Columns + c);
+				}
+				cells[i] = static_cast<uint8_t>(mask) ^ flip;
+			}
+		}
+	}
+
+	/// Thresholds and masks of the cell rows [rowBegin, rowEnd), with the loops unrolled for the table's cell size
+	void maskBand(const uint16_t* luma, int width, int rowBegin, int rowEnd, const MaskGlyphTable& table, bool inverted,
+	              uint16_t* thresholds, uint8_t* masks) {
+		auto run = [&](auto columns, auto rows) {
+			cellThresholds<columns, rows>(luma, width, rowBegin, rowEnd, thresholds);
+			maskRows<columns, rows>(luma, width, rowBegin, rowEnd, inverted, thresholds, masks);
+		};
+		if (table.columns == 1) run(std::integral_constant<int, 1>{}, std::integral_constant<int, 2>{});
+		else if (table.rows == 2) run(std::integral_constant<int, 2>{}, std::integral_constant<int, 2>{});
+		else run(std::integral_constant<int, 2>{}, std::integral_constant<int, 4>{});
+	}
+}
+
+void quantizeLevels(const uint16_t* luma, size_t count, const GlyphTable& table, uint8_t* levels) {
+	size_t i = 0;
+	const size_t thresholds = table.levels - 1;
+
+#if defined(__AVX2__)
+	// SIMD has no unsigned 16-bit compare, so flip the sign bit of both sides and use the signed one: q >= t <=> q > t - 1
+	const __m256i bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+	__m256i limits[MAX_GLYPH_LEVELS];
+	for (size_t t = 0; t < thresholds; t++) {
+		limits[t] = _mm256_set1_epi16(static_cast<short>((table.thresholds[t] - 1) ^ 0x8000));
+	}
+	for (; i + 16 <= count; i += 16) {
+		const __m256i q = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(luma + i)), bias);
+		__m256i level = _mm256_setzero_si256();
+		for (size_t t = 0; t < thresholds; t++) {
+			// A true compare is -1, so subtracting it counts the thresholds reached
+			level = _mm256_sub_epi16(level, _mm256_cmpgt_epi16(q, limits[t]));
+		}
+		// packus works per 128-bit lane, gather the two low quadwords back together
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(level, level), 0x08);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(levels + i), _mm256_castsi256_si128(packed));
+	}
+#elif defined(__SSE2__)
+	// SIMD has no unsigned 16-bit compare, so flip the sign bit of both sides and use the signed one: q >= t <=> q > t - 1
+	const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+	__m128i limits[MAX_GLYPH_LEVELS];
+	for (size_t t = 0; t < thresholds; t++) {
+		limits[t] = _mm_set1_epi16(static_cast<short>((table.thresholds[t] - 1) ^ 0x8000));
+	}
+	for (; i + 8 <= count; i += 8) {
+		const __m128i q = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(luma + i)), bias);
+		__m128i level = _mm_setzero_si128();
+		for (size_t t = 0; t < thresholds; t++) {
+			// A true compare is -1, so subtracting it counts the thresholds reached
+			level = _mm_sub_epi16(level, _mm_cmpgt_epi16(q, limits[t]));
+		}
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(levels + i), _mm_packus_epi16(level, level));
+	}
+#endif
+
+	quantizeScalar(luma + i, count - i, table, levels + i);
+}
+
+void mapGlyphs(const uint16_t* luma, int width, int height, const GlyphTable& table,
+               std::string& out, GlyphMapScratch& scratch, unsigned int threads) {
+	const size_t cells = static_cast<size_t>(width) * height;
+	threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(cells / MIN_CELLS_PER_THREAD)));
+
+	scratch.levels.resize(cells);
+	scratch.rowOffsets.resize(static_cast<size_t>(height) + 1);
+	scratch.rowOffsets[0] = 0;
+
+	// Pass 1: quantize and measure every row, so each band knows exactly where its output starts
+	forEachBand(height, threads, [&](int begin, int end) { measureBand(luma, width, begin, end, table, scratch); });
+	for (int j = 0; j < height; j++) {
+		scratch.rowOffsets[j + 1] += scratch.rowOffsets[j];
+	}
+	const size_t total = scratch.rowOffsets[height];
+
+	// Pass 2: copy the glyphs into the exactly sized buffer
+	out.resize(total);
+	char* dst = out.data();
+	forEachBand(height, threads, [&](int begin, int end) { emitBand(width, begin, end, table, scratch, dst); });
+}
+
+void computeMasks(const uint16_t* luma, int width, int height, const MaskGlyphTable& table, bool inverted,
+                  uint8_t* masks, GlyphMapScratch& scratch) {
+	const int cellsWide = width / table.columns;
+	const int cellsHigh = height / table.rows;
+	scratch.thresholds.resize(static_cast<size_t>(cellsWide) * cellsHigh);
+	maskBand(luma, width, 0, cellsHigh, table, inverted, scratch.thresholds.data(), masks);
+}
+
+void mapSubcells(const uint16_t* luma, int width, int height, const MaskGlyphTable& table, bool inverted,
+                 std::string& out, GlyphMapScratch& scratch, unsigned int threads) {
+	const int cellsWide = width / table.columns;
+	const int cellsHigh = height / table.rows;
+	const size_t cells = static_cast<size_t>(cellsWide) * cellsHigh;
+	threads = std::max(1u, std::min<unsigned int>(threads, static_cast<unsigned int>(cells / MIN_CELLS_PER_THREAD)));
+
+	scratch.levels.resize(cells);
+	scratch.thresholds.resize(cells);
+	scratch.rowOffsets.resize(static_cast<size_t>(cellsHigh) + 1);
+	scratch.rowOffsets[0] = 0;
+
+	// Pass 1: masks and row lengths, then the same exactly sized emit as mapGlyphs with masks as levels
+	forEachBand(cellsHigh, threads, [&](int begin, int end) {
+		maskBand(luma, width, begin, end, table, inverted, scratch.thresholds.data(), scratch.levels.data());
+		measureRows(cellsWide, begin, end, table, scratch);
+	});
+	for (int j = 0; j < cellsHigh; j++) {
+		scratch.rowOffsets[j + 1] += scratch.rowOffsets[j];
+	}
+	const size_t total = scratch.rowOffsets[cellsHigh];
+
+	// Pass 2: copy the glyphs into the exactly sized buffer
+	out.resize(total);
+	char* dst = out.data();
+	forEachBand(cellsHigh, threads, [&](int begin, int end) { emitBand(cellsWide, begin, end, table, scratch, dst); });
+}
+
+void splitCellColors(const uint8_t* rgb, int width, int x, int y, uint8_t mask, const MaskGlyphTable& table,
+                     uint8_t foreground[3], uint8_t background[3]) {
+	uint32_t sums[2][3] = {};
+	uint32_t counts[2] = {};
+	for (int r = 0; r < table.rows; r++) {
+		const uint8_t* p = rgb + ((static_cast<size_t>(y) * table.rows + r) * width + static_cast<size_t>(x) * table.columns) * 3;
+		for (int c = 0; c < table.columns; c++, p += 3) {
+			const int side = mask >> (r * table.columns + c) & 1;
+			sums[side][0] += p[0];
+			sums[side][1] += p[1];
+			sums[side][2] += p[2];
+			counts[side]++;
+		}
+	}
+	const uint32_t total = counts[0] + counts[1];
+	for (int ch = 0; ch < 3; ch++) {
+		const uint32_t all = sums[0][ch] + sums[1][ch];
+		foreground[ch] = static_cast<uint8_t>(counts[1] != 0 ? (sums[1][ch] + counts[1] / 2) / counts[1] : (all + total / 2) / total);
+		background[ch] = static_cast<uint8_t>(counts[0] != 0 ? (sums[0][ch] + counts[0] / 2) / counts[0] : (all + total / 2) / total);
+	}
+}
+
+GlyphMode parseGlyphMode(const std::string& name) {
+	if (name == "shade") return GlyphMode::Shade;
+	if (name == "half") return GlyphMode::HalfBlock;
+	if (name == "quadrant") return GlyphMode::Quadrant;
+	if (name == "braille") return GlyphMode::Braille;
+	throw std::invalid_argument("Unknown glyph set: " + name);
+}
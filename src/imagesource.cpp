@@ -0,0 +1,184 @@
+#include "imagesource.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "bmp.h"
+#include "magickmodule.h"
+#include "profiler.h"
+
+namespace {
+	// Enough of the file to tell the formats apart and to check a BMP header for support
+	constexpr size_t SNIFF_BYTES = 128;
+
+	constexpr size_t QOI_HEADER = 14;
+	constexpr size_t QOI_PADDING = 8;
+	constexpr size_t QOI_MAX_PIXELS = 400000000;  // the limit of the reference decoder
+
+	uint32_t readBe32(const uint8_t* p) {
+		return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+	}
+
+	std::vector<uint8_t> readFile(const std::string& path) {
+		ProfileScope stage("read");
+		std::ifstream in(path, std::ios::binary | std::ios::ate);
+		if (!in) throw std::runtime_error("Could not open " + path);
+		std::vector<uint8_t> data(static_cast<size_t>(in.tellg()));
+		in.seekg(0);
+		if (!in.read(reinterpret_cast<char*>(data.data()), data.size())) throw std::runtime_error("Could not read " + path);
+		return data;
+	}
+
+	// Decodes a QOI image into rgb triples, dropping alpha like the "RGB" export of ImageMagick does
+	void decodeQoi(const std::vector<uint8_t>& file, size_t& width, size_t& height, std::vector<uint8_t>& rgb) {
+		if (file.size() < QOI_HEADER + QOI_PADDING || std::memcmp(file.data(), "qoif", 4) != 0) throw std::runtime_error("Not a QOI image");
+		width = readBe32(file.data() + 4);
+		height = readBe32(file.data() + 8);
+		if (width == 0 || height == 0 || height > QOI_MAX_PIXELS / width) throw std::runtime_error("Invalid QOI image size");
+
+		uint8_t index[64][4] = {};
+		uint8_t px[4] = {0, 0, 0, 255};
+		const size_t end = file.size() - QOI_PADDING;
+		size_t pos = QOI_HEADER;
+		int run = 0;
+
+		rgb.resize(width * height * 3);
+		for (uint8_t* out = rgb.data(); out != rgb.data() + rgb.size(); out += 3) {
+			if (run > 0) {
+				run--;
+			} else if (pos < end) {
+				// The end padding guarantees the up to 4 bytes after an op are readable
+				const uint8_t op = file[pos++];
+				if (op == 0xFE) {
+					std::memcpy(px, &file[pos], 3);
+					pos += 3;
+				} else if (op == 0xFF) {
+					std::memcpy(px, &file[pos], 4);
+					pos += 4;
+				} else if ((op & 0xC0) == 0x00) {
+					std::memcpy(px, index[op], 4);
+				} else if ((op & 0xC0) == 0x40) {
+					px[0] += ((op >> 4) & 0x03) - 2;
+					px[1] += ((op >> 2) & 0x03) - 2;
+					px[2] += (op & 0x03) - 2;
+				} else if ((op & 0xC0) == 0x80) {
+					const uint8_t next = file[pos++];
+					const int greenDiff = (op & 0x3F) - 32;
+					px[0] += greenDiff - 8 + ((next >> 4) & 0x0F);
+					px[1] += greenDiff;
+					px[2] += greenDiff - 8 + (next & 0x0F);
+				} else {
+					run = op & 0x3F;
+				}
+				std::memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+			}
+			std::memcpy(out, px, 3);
+		}
+	}
+
+	class PnmSource : public ImageSource {
+	public:
+		explicit PnmSource(std::string path) : path(std::move(path)) {}
+
+		ReducedGrid reduce(Parameters& params) override {
+			const std::vector<uint8_t> file = readFile(path);
+			PixelLayout layout;
+			size_t dataOffset = 0;
+			if (!parsePnmHeader(file.data(), file.size(), layout, dataOffset)) throw std::runtime_error("Invalid or truncated PNM: " + path);
+			return reducePixels(params, file.data() + dataOffset, layout);
+		}
+
+	private:
+		std::string path;
+	};
+
+	class BmpSource : public ImageSource {
+	public:
+		explicit BmpSource(std::string path) : path(std::move(path)) {}
+
+		ReducedGrid reduce(Parameters& params) override {
+			const std::vector<uint8_t> file = readFile(path);
+			BmpHeader header;
+			if (!parseBmpHeader(file.data(), file.size(), header)) throw std::runtime_error("Unsupported BMP: " + path);
+			const BmpRows rows(file.data(), file.size(), header);
+			PixelLayout layout;
+			layout.width = rows.width();
+			layout.height = rows.height();
+			layout.channels = 3;
+			std::vector<uint8_t> rgb(layout.rowBytes() * layout.height);
+			{
+				ProfileScope stage("decode");
+				for (size_t y = 0; y < layout.height; y++) rows.decodeRow(y, rgb.data() + y * layout.rowBytes());
+			}
+			return reducePixels(params, rgb.data(), layout);
+		}
+
+	private:
+		std::string path;
+	};
+
+	class QoiSource : public ImageSource {
+	public:
+		explicit QoiSource(std::string path) : path(std::move(path)) {}
+
+		ReducedGrid reduce(Parameters& params) override {
+			const std::vector<uint8_t> file = readFile(path);
+			PixelLayout layout;
+			layout.channels = 3;
+			std::vector<uint8_t> rgb;
+			{
+				ProfileScope stage("decode");
+				decodeQoi(file, layout.width, layout.height, rgb);
+			}
+			return reducePixels(params, rgb.data(), layout);
+		}
+
+	private:
+		std::string path;
+	};
+
+	class RawSource : public ImageSource {
+	public:
+		RawSource(int width, int height) : width(width), height(height) {}
+
+		ReducedGrid reduce(Parameters& params) override {
+			if (width <= 0 || height <= 0) throw std::invalid_argument("Raw input needs its size (--raw WxH)");
+			PixelLayout layout;
+			layout.width = static_cast<size_t>(width);
+			layout.height = static_cast<size_t>(height);
+			layout.channels = 1;
+			std::vector<uint8_t> gray(layout.width * layout.height);
+			{
+				ProfileScope stage("read");
+				if (std::fread(gray.data(), 1, gray.size(), stdin) != gray.size()) throw std::runtime_error("Raw input ended early");
+			}
+			return reducePixels(params, gray.data(), layout);
+		}
+
+	private:
+		int width;
+		int height;
+	};
+}
+
+std::unique_ptr<ImageSource> openImageSource(const std::string& path) {
+	uint8_t head[SNIFF_BYTES];
+	size_t length = 0;
+	{
+		std::ifstream in(path, std::ios::binary);
+		in.read(reinterpret_cast<char*>(head), sizeof(head));
+		length = static_cast<size_t>(in.gcount());
+	}
+
+	BmpHeader bmp;
+	if (length >= 2 && head[0] == 'P' && (head[1] == '5' || head[1] == '6')) return std::make_unique<PnmSource>(path);
+	if (parseBmpHeader(head, length, bmp)) return std::make_unique<BmpSource>(path);
+	if (length >= 4 && std::memcmp(head, "qoif", 4) == 0) return std::make_unique<QoiSource>(path);
+	return magickModule().openSource(path);
+}
+
+std::unique_ptr<ImageSource> openRawSource(int width, int height) {
+	return std::make_unique<RawSource>(width, height);
+}
@@ -0,0 +1,255 @@
+// Everything of the renderer that calls into ImageMagick. The command-line renderer loads this part as a module on
+// first use (see magickmodule.h), so none of it may be needed by the built-in decoders.
+#include "asciirenderer.h"
+
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include "colorhelper.h"
+#include "imagesource.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "tiled.h"
+
+using namespace Magick;
+
+namespace {
+	std::once_flag magickInitialized;
+
+	// Larger images are scaled down to fit this square before sampling, plenty for a handful of colors
+	constexpr int ACCENT_SAMPLE_SIZE = 100;
+
+	/// Holds ImageMagick's memory and map limits at a budget while it lives. The limits are process-wide, so the
+	/// previous ones come back afterwards, also when decoding throws.
+	class ResourceBudget {
+	public:
+		explicit ResourceBudget(size_t budget)
+			: memory(MagickCore::GetMagickResourceLimit(MagickCore::MemoryResource)),
+			  map(MagickCore::GetMagickResourceLimit(MagickCore::MapResource)) {
+			MagickCore::SetMagickResourceLimit(MagickCore::MemoryResource, budget);
+			MagickCore::SetMagickResourceLimit(MagickCore::MapResource, budget);
+		}
+
+		~ResourceBudget() {
+			MagickCore::SetMagickResourceLimit(MagickCore::MemoryResource, memory);
+			MagickCore::SetMagickResourceLimit(MagickCore::MapResource, map);
+		}
+
+		ResourceBudget(const ResourceBudget&) = delete;
+		ResourceBudget& operator=(const ResourceBudget&) = delete;
+
+	private:
+		MagickCore::MagickSizeType memory;
+		MagickCore::MagickSizeType map;
+	};
+
+	/// Shared by the file and the in-memory decode: Source is a path or a Blob
+	template <typename Source>
+	Image decodeReduced(Parameters& params, const Source& source) {
+		ensureMagick();
+
+		// Read only the header first, the output size decides how much of the image we actually need
+		Image input;
+		input.subRange(1);
+		{
+			ProfileScope stage("ping");
+			input.ping(source);
+		}
+
+		// Calculate target size keeping aspect ratio in mind
+		fitTargetSize(params, input.columns(), input.rows());
+
+		// Let decoders that can scale while decoding (JPEG DCT scaling) skip the pixels we would throw away anyway.
+		// Twice the grid size keeps at least 2x2 source pixels per cell for the area average below.
+		input.defineValue("jpeg", "size", decodeSizeHint(params));
+		{
+			ProfileScope stage("decode");
+			input.read(source);
+		}
+
+		// Area-average straight down to the character grid, which also takes care of denoising
+		{
+			ProfileScope stage("area reduce");
+			input.scale(gridGeometry(params));
+		}
+		return input;
+	}
+
+	/// Any format ImageMagick reads, initialized on the way
+	class MagickSource : public ImageSource {
+	public:
+		explicit MagickSource(std::string path) : path(std::move(path)) {}
+
+		ReducedGrid reduce(Parameters& params) override {
+			params.in_filepath = path;
+			const Image reduced = decodeForRender(params);
+			ReducedGrid grid;
+			grid.width = static_cast<int>(reduced.columns());
+			grid.height = static_cast<int>(reduced.rows());
+			if (grid.width == 0 || grid.height == 0) throw std::runtime_error("Image has no pixels");
+
+			ProfileScope stage("pixel export");
+			const size_t cells = static_cast<size_t>(grid.width) * grid.height;
+			grid.luma.resize(cells);
+			grid.rgb.resize(cells * 3);
+			reduced.write(0, 0, grid.width, grid.height, "I", ShortPixel, grid.luma.data());
+			reduced.write(0, 0, grid.width, grid.height, "RGB", CharPixel, grid.rgb.data());
+			return grid;
+		}
+
+	private:
+		std::string path;
+	};
+}
+
+void ensureMagick() {
+	// Loading its configuration and coder modules dominates the startup of small renders, so it only
+	// happens for inputs the built-in decoders do not handle
+	std::call_once(magickInitialized, [] {
+		ProfileScope stage("magick init");
+		InitializeMagick(getMagickPath().empty() ? nullptr : getMagickPath().c_str());
+	});
+}
+
+Geometry gridGeometry(const Parameters& params) {
+	const long width = std::max(1L, std::lround(params.target_width)) * subcellColumns(params.glyphMode);
+	const long height = std::max(1L, std::lround(params.target_height)) * subcellRows(params.glyphMode);
+	return Geometry(std::to_string(width) + "x" + std::to_string(height) + "!");
+}
+
+Image decodeForRender(Parameters& params) {
+	return decodeReduced(params, params.in_filepath);
+}
+
+Image decodeForRender(Parameters& params, const Blob& data) {
+	return decodeReduced(params, data);
+}
+
+std::unique_ptr<ImageSource> openMagickSource(const std::string& path) {
+	return std::make_unique<MagickSource>(path);
+}
+
+void streamImageRows(Parameters& params, size_t memoryBudget, MagickCore::StreamHandler handler) {
+	ensureMagick();
+
+	// Header only, for the grid size and the decoder size hint
+	{
+		ProfileScope stage("ping");
+		Image input;
+		input.subRange(1);
+		input.ping(params.in_filepath);
+		// These coders queue their rows bottom-up, which a handler taking rows in the order they arrive cannot place
+		static const char* const bottomUpCoders[] = {"BMP", "BMP2", "BMP3", "DIB", "ICO", "CUR", "TGA"};
+		const std::string coder = input.magick();
+		for (const char* bottomUp : bottomUpCoders) {
+			if (coder == bottomUp) throw std::runtime_error("Cannot stream " + coder + " images row by row, their rows are decoded bottom-up");
+		}
+		fitTargetSize(params, input.columns(), input.rows());
+	}
+
+	// Anything the coder caches goes to disk instead of growing past the budget
+	const ResourceBudget budget(memoryBudget);
+
+	MagickCore::ImageInfo* info = MagickCore::AcquireImageInfo();
+	MagickCore::CopyMagickString(info->filename, params.in_filepath.c_str(), sizeof(info->filename));
+	MagickCore::SetImageOption(info, "jpeg:size", decodeSizeHint(params).c_str());
+	MagickCore::ExceptionInfo* exception = MagickCore::AcquireExceptionInfo();
+
+	{
+		ProfileScope stage("strip reduce");
+		MagickCore::Image* image = MagickCore::ReadStream(info, handler, exception);
+		if (image != nullptr) MagickCore::DestroyImageList(image);
+	}
+
+	std::string error;
+	if (exception->severity >= MagickCore::ErrorException) {
+		error = exception->reason != nullptr ? exception->reason : "Could not decode image";
+		if (exception->description != nullptr) error += std::string(" (") + exception->description + ")";
+	}
+	MagickCore::DestroyExceptionInfo(exception);
+	MagickCore::DestroyImageInfo(info);
+	if (!error.empty()) throw std::runtime_error(error);
+}
+
+RenderResult Renderer::exportPlanes(const Image& reduced) {
+	const int width = reduced.columns();
+	const int height = reduced.rows();
+	if (width == 0 || height == 0) return fail(RenderError::EmptyImage, "Image has no pixels");
+
+	const size_t cells = static_cast<size_t>(width) * height;
+	ProfileScope stage("pixel export");
+	try {
+		// One contiguous plane of 16-bit quanta for the mapping kernel, resize keeps the capacity of earlier renders
+		luma.resize(cells);
+		reduced.write(0, 0, width, height, "I", ShortPixel, luma.data());
+		if (params.cellColor != ColorMode::None) {
+			rgb.resize(cells * 3);
+			reduced.write(0, 0, width, height, "RGB", CharPixel, rgb.data());
+		}
+	} catch (const std::exception& e) {
+		return fail(RenderError::PixelExport, e.what());
+	}
+
+	RenderResult result;
+	result.width = width;
+	result.height = height;
+	return result;
+}
+
+RenderResult Renderer::render(const Image& reduced, std::string& out) {
+	const RenderResult exported = exportPlanes(reduced);
+	if (!exported) return exported;
+	const uint8_t* rgbPlane = params.cellColor != ColorMode::None ? rgb.data() : nullptr;
+	return render(luma.data(), rgbPlane, exported.width, exported.height, out);
+}
+
+RenderResult Renderer::render(const Image& reduced, char* buffer, size_t capacity) {
+	RenderResult result = render(reduced, arena);
+	if (!result) return result;
+	if (result.bytes > capacity) {
+		const size_t needed = result.bytes;
+		result = fail(RenderError::BufferTooSmall, "Output buffer is too small for the art");
+		result.bytes = needed;
+		return result;
+	}
+	std::memcpy(buffer, arena.data(), result.bytes);
+	return result;
+}
+
+RenderResult Renderer::render(const Image& reduced, RenderSink sink, void* context) {
+	const RenderResult result = render(reduced, arena);
+	if (result) sink(context, arena.data(), arena.size());
+	return result;
+}
+
+std::vector<PaletteColor> extractPalette(const Image& image, int count) {
+	std::vector<uint8_t> rgb;
+	size_t pixels = 0;
+	{
+		ProfileScope stage("accent reduce");
+		// The render grid is usually small enough already, anything bigger is area averaged down
+		Image sample(image);
+		if (sample.columns() > ACCENT_SAMPLE_SIZE || sample.rows() > ACCENT_SAMPLE_SIZE) {
+			sample.scale(Geometry(ACCENT_SAMPLE_SIZE, ACCENT_SAMPLE_SIZE));
+		}
+		pixels = sample.columns() * sample.rows();
+		rgb.resize(pixels * 3);
+		sample.write(0, 0, sample.columns(), sample.rows(), "RGB", CharPixel, rgb.data());
+	}
+
+	ProfileScope stage("accent cluster");
+	return extractPalette(rgb.data(), pixels, count);
+}
+
+std::tuple<int,int,int> extractAccentColor(const Image& image) {
+	try {
+		const std::vector<PaletteColor> palette = extractPalette(image, 5);
+		if (palette.empty()) {
+			throw std::runtime_error("Image has no pixels to extract colors from.");
+		}
+		return pickAccentColor(palette);
+	} catch (const std::exception& e) {
+		std::cerr << "Encountered an error trying to extract accent colors: " << e.what() << std::endl;
+		return {180, 180, 180};
+	}
+}
@@ -0,0 +1,44 @@
+// magickModule() of the command-line renderer, which is linked without ImageMagick and loads the module holding
+// everything that needs it the first time it is asked for
+#include "magickmodule.h"
+
+#include <climits>
+#include <stdexcept>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#ifndef ASCIIRENDERER_MAGICK_MODULE
+#define ASCIIRENDERER_MAGICK_MODULE "libasciirenderer-magick.so"
+#endif
+
+namespace {
+	// Directory of the running executable with a trailing slash, empty if the kernel does not tell
+	std::string executableDirectory() {
+		char path[PATH_MAX];
+		const ssize_t length = ::readlink("/proc/self/exe", path, sizeof(path));
+		if (length <= 0 || length == sizeof(path)) return "";
+		const std::string executable(path, static_cast<size_t>(length));
+		return executable.substr(0, executable.rfind('/') + 1);
+	}
+
+	const MagickModule* loadModule() {
+		// The module is built next to the executable, the dynamic loader's search path is the fallback. Symbols of
+		// the renderer core that the module uses resolve against the executable, which exports them.
+		void* handle = ::dlopen((executableDirectory() + ASCIIRENDERER_MAGICK_MODULE).c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (handle == nullptr) {
+			const std::string error = ::dlerror();
+			handle = ::dlopen(ASCIIRENDERER_MAGICK_MODULE, RTLD_NOW | RTLD_LOCAL);
+			if (handle == nullptr) throw std::runtime_error("Could not load ImageMagick support: " + error);
+		}
+		using Entry = const MagickModule* (*)();
+		const auto entry = reinterpret_cast<Entry>(::dlsym(handle, "asciirendererMagickModule"));
+		if (entry == nullptr) throw std::runtime_error(std::string("Could not load ImageMagick support: ") + ::dlerror());
+		return entry();
+	}
+}
+
+const MagickModule& magickModule() {
+	// A failed load leaves the static uninitialized, so the next caller tries again
+	static const MagickModule* const module = loadModule();
+	return *module;
+}
@@ -0,0 +1,10 @@
+#include "magickmodule.h"
+
+extern "C" const MagickModule* asciirendererMagickModule() {
+	static const MagickModule module = {openMagickSource, streamImageRows, runBatch, runDaemon, runStream};
+	return &module;
+}
+
+const MagickModule& magickModule() {
+	return *asciirendererMagickModule();
+}
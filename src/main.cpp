@@ -1,26 +1,41 @@
 // Standart includes
 #include <iostream>
 #include <fstream>
+#include <memory>
 
 // External includes
 #include <external/cxxopts.hpp>
 
 // My includes
 #include <asciirenderer.h>
+#include <batch.h>
 #include <colorhelper.h>
+#include <daemon.h>
+#include <imagesource.h>
+#include <magickmodule.h>
+#include <profiler.h>
+#include <renderer.h>
+#include <stream.h>
+#include <tiled.h>
 
 using namespace Magick; 
 
 Parameters params;
+BatchOptions batch;
+StreamOptions stream;
+DaemonOptions daemonOptions;
+bool printStats = false;
+bool profile = false;
+size_t memoryBudget = 0;  // bytes, 0 -> decode the whole image in memory
 
 int main(int argc, char const *argv[]) {
-	// Set up Magick
-	InitializeMagick(*argv);
+	// Set up Magick, loaded and initialized only once a format needs it
+	setMagickPath(*argv);
 
 	// Read and set up Options
 	cxxopts::Options options("Ascii renderer", "Renders given image in ASCII");
 	options.add_options()
-		("i,input", "Path to the input file (required)", cxxopts::value<std::string>())
+		("i,input", "Path to the input file, or '-' for a raw grayscale image on stdin (required)", cxxopts::value<std::string>())
 		("o,output", "Saves the ASCII art to a path", cxxopts::value<std::string>())
 		("p,print", "Prints the ASCII art to console after rendering")
 		("w,width", "Target ASCII art character width", cxxopts::value<int>())
@@ -28,6 +43,21 @@ int main(int argc, char const *argv[]) {
 		("s,squishfactor", "Adjust vertical squish/stretch. Larger value -> more squished.", cxxopts::value<double>())
 		("n,invert", "Inverts colors of ASCII art to black on white")
 		("c,color", "Render image in terminal using an automatically calculated accent color")
+		("C,cellcolor", "Color every glyph with its source pixel: 'truecolor' or '256'", cxxopts::value<std::string>())
+		("colorbits", "Bits per channel kept when comparing cell colors (1-8), fewer -> fewer escapes", cxxopts::value<int>())
+		("g,glyphs", "Glyph set: 'shade' (default), or 'half', 'quadrant' or 'braille' to draw 2, 4 or 8 sub-pixels per character", cxxopts::value<std::string>())
+		("stats", "Print output size statistics of the rendering")
+		("profile", "Print wall time, bytes allocated, heap growth and peak RSS of every rendering stage")
+		("maxmem", "Render huge images in strips, holding at most the given MiB of the source in memory", cxxopts::value<size_t>())
+		("b,batch", "Render every image in a directory, a glob pattern, or a newline-delimited manifest read from stdin ('-')", cxxopts::value<std::string>())
+		("d,outdir", "Output directory of a batch run, mirrors the input layout", cxxopts::value<std::string>())
+		("j,jobs", "Number of worker threads for batch and daemon mode (default: all cores)", cxxopts::value<unsigned int>())
+		("a,animate", "Play an animated image, a frame sequence (glob pattern) or raw frames from stdin ('-') in the terminal", cxxopts::value<std::string>())
+		("fps", "Target frame rate of --animate (default: the animation's own timing)", cxxopts::value<double>())
+		("raw", "Size of the raw 8-bit grayscale image or frames read from stdin ('-'), as WxH", cxxopts::value<std::string>())
+		("loop", "Restart the animation when it ends")
+		("daemon", "Serve render requests on the given Unix domain socket", cxxopts::value<std::string>())
+		("cachemb", "Memory cap of the daemon's result cache in MiB (default: 256)", cxxopts::value<size_t>())
 		("h,help", "Show this help page");
 
 	try {
@@ -40,11 +70,31 @@ int main(int argc, char const *argv[]) {
 		}
 
 		// Get all parameters
-		if (result.count("input")) {
+		if (result.count("batch")) {
+			batch.source = result["batch"].as<std::string>();
+			if (!result.count("outdir")) throw std::invalid_argument("Batch mode requires an output directory (--outdir)");
+			batch.out_dir = result["outdir"].as<std::string>();
+			if (result.count("jobs")) batch.jobs = result["jobs"].as<unsigned int>();
+		} else if (result.count("daemon")) {
+			daemonOptions.socket_path = result["daemon"].as<std::string>();
+			if (result.count("cachemb")) daemonOptions.cache_bytes = result["cachemb"].as<size_t>() << 20;
+			if (result.count("jobs")) daemonOptions.jobs = result["jobs"].as<unsigned int>();
+		} else if (result.count("animate")) {
+			stream.source = result["animate"].as<std::string>();
+			if (result.count("fps")) stream.fps = result["fps"].as<double>();
+			if (result.count("loop")) stream.loop = true;
+		} else if (result.count("input")) {
 			params.in_filepath = result["input"].as<std::string>();
 		} else {
 			throw std::invalid_argument("No input path specified");
 		}
+		if (result.count("raw")) {
+			const std::string size = result["raw"].as<std::string>();
+			const size_t x = size.find('x');
+			if (x == std::string::npos) throw std::invalid_argument("--raw expects WxH, got " + size);
+			stream.raw_width = std::stoi(size.substr(0, x));
+			stream.raw_height = std::stoi(size.substr(x + 1));
+		}
 		if (result.count("output")) params.out_filepath = result["output"].as<std::string>();
 		if (result.count("width")) params.target_width = result["width"].as<int>();
 		if (result.count("height")) params.target_height = result["height"].as<int>();
@@ -52,6 +102,12 @@ int main(int argc, char const *argv[]) {
 		if (result.count("invert")) params.inverted = true;
 		if (result.count("color")) params.inColor = true;
 		if (result.count("print")) params.print = true;
+		if (result.count("cellcolor")) params.cellColor = parseColorMode(result["cellcolor"].as<std::string>());
+		if (result.count("colorbits")) params.colorBits = result["colorbits"].as<int>();
+		if (result.count("glyphs")) params.glyphMode = parseGlyphMode(result["glyphs"].as<std::string>());
+		if (result.count("stats")) printStats = true;
+		if (result.count("profile")) profile = true;
+		if (result.count("maxmem")) memoryBudget = result["maxmem"].as<size_t>() << 20;
 		params.pixelRatio *= params.squishfactor;
 
 	} catch (const std::exception& e) {
@@ -59,8 +115,72 @@ int main(int argc, char const *argv[]) {
 		return 1;
 	}
 	
-	// get the image
-	std::string art = renderImage(params);
+	if (!batch.source.empty()) {
+		try {
+			return magickModule().runBatch(batch, params) == 0 ? 0 : 2;
+		} catch (const std::exception& e) {
+			std::cerr << "Error in batch run: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (!daemonOptions.socket_path.empty()) {
+		try {
+			return magickModule().runDaemon(daemonOptions, params);
+		} catch (const std::exception& e) {
+			std::cerr << "Error in daemon: " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (!stream.source.empty()) {
+		try {
+			const StreamStats stats = magickModule().runStream(stream, params);
+			std::cerr << "Frames: " << stats.emitted << " shown, " << stats.droppedLate << " dropped late, "
+			          << stats.droppedSource << " dropped at source, " << stats.decoded << " decoded" << std::endl;
+			if (stats.seconds > 0) {
+				std::cerr << "Achieved " << (stats.emitted - 1) / stats.seconds << " fps, "
+				          << stats.bytes / std::max<size_t>(stats.emitted, 1) << " bytes/frame" << std::endl;
+			}
+		} catch (const std::exception& e) {
+			std::cerr << "Error while streaming: " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// Collects the stages of this render for --profile
+	std::unique_ptr<Profiler> profiler;
+	if (profile) profiler = std::make_unique<Profiler>();
+
+	// get the image, reduced to the grid once for both the glyph and the accent color pass. Common formats are
+	// decoded by built-in decoders, with a memory budget the source is reduced strip by strip instead.
+	ReducedGrid grid;
+	try {
+		if (memoryBudget != 0) grid = reduceTiled(params, memoryBudget);
+		else if (params.in_filepath == "-") grid = openRawSource(stream.raw_width, stream.raw_height)->reduce(params);
+		else grid = openImageSource(params.in_filepath)->reduce(params);
+	} catch (const std::exception& e) {
+		std::cerr << "Error reading / editing image: " << e.what() << std::endl;
+		return 1;
+	}
+	Renderer renderer(params);
+	std::string art;
+	const uint8_t* rgbPlane = params.cellColor != ColorMode::None ? grid.rgb.data() : nullptr;
+	if (!renderer.render(grid.luma.data(), rgbPlane, grid.width, grid.height, art)) {
+		std::cerr << "Error reading / editing image: " << renderer.errorMessage() << std::endl;
+		return 1;
+	}
+
+	std::tuple<int,int,int> accent;
+	if (params.print && params.inColor && params.cellColor == ColorMode::None) {
+		ProfileScope stage("accent color");
+		accent = pickAccentColor(extractPalette(grid.rgb.data(), grid.luma.size()));
+	}
+
+	// Everything from here on is the output stage of --profile
+	std::optional<ProfileScope> outputStage;
+	outputStage.emplace("output");
 
 	// store it
 	if (params.out_filepath) {
@@ -70,9 +190,20 @@ int main(int argc, char const *argv[]) {
 		}
 		out << art;
 	}
+	if (printStats) {
+		const size_t cells = static_cast<size_t>(std::lround(params.target_width)) * std::lround(params.target_height);
+		std::cerr << "Output: " << art.size() << " bytes/frame, " << cells << " cells, "
+		          << static_cast<double>(art.size()) / std::max<size_t>(cells, 1) << " bytes/cell";
+		if (params.cellColor != ColorMode::None) std::cerr << ", " << renderer.encodeStats().sgrSequences << " color escapes";
+		std::cerr << std::endl;
+	}
 	if (params.print) {
-		if (params.inColor) {
-			auto [r, g, b] = extractAccentColor(params.in_filepath);
+		if (params.cellColor != ColorMode::None) {
+			// Already carries its colors, hand it to the terminal in one write
+			std::cout.flush();
+			writeToStdout(art);
+		} else if (params.inColor) {
+			auto [r, g, b] = accent;
 
 			auto [br, bg, bb] = makeBackgroundColor(r, g, b);
 			auto [fr, fg, fb] = makeForegroundColor(r, g, b);
@@ -82,5 +213,9 @@ int main(int argc, char const *argv[]) {
 			std::cout << art << std::endl;
 		}
 	}
+	std::cout.flush();
+	outputStage.reset();
+
+	if (profiler) profiler->report(std::cerr);
 	return 0;
 }
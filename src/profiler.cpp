@@ -0,0 +1,91 @@
+#include "profiler.h"
+
+#include <iomanip>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+std::atomic<int> liveProfilers{0};
+std::atomic<long long> allocatedTotal{0};
+
+namespace {
+	thread_local Profiler* activeProfiler = nullptr;
+}
+
+long long bytesAllocated() {
+	return allocatedTotal.load(std::memory_order_relaxed);
+}
+
+long long heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	// Small chunks plus mmap'ed large blocks, which is where big pixel buffers end up
+	const struct mallinfo2 info = mallinfo2();
+	return static_cast<long long>(info.uordblks + info.hblkhd);
+#else
+	return 0;
+#endif
+}
+
+long peakRssKb() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+Profiler::Profiler() : previous(activeProfiler) {
+	activeProfiler = this;
+	liveProfilers.fetch_add(1, std::memory_order_relaxed);
+}
+
+Profiler::~Profiler() {
+	liveProfilers.fetch_sub(1, std::memory_order_relaxed);
+	activeProfiler = previous;
+}
+
+Profiler* Profiler::active() {
+	return activeProfiler;
+}
+
+void Profiler::report(std::ostream& out) const {
+	double total = 0;
+	out << std::left << std::setw(24) << "stage" << std::right << std::setw(12) << "ms" << std::setw(14) << "alloc KiB"
+	    << std::setw(14) << "heap KiB" << std::setw(14) << "peak RSS KiB" << '\n';
+	for (const StageSample& sample : samples) {
+		out << std::left << std::setw(24) << sample.name << std::right << std::fixed << std::setprecision(3)
+		    << std::setw(12) << sample.millis << std::setw(14) << sample.allocatedBytes / 1024
+		    << std::setw(14) << sample.heapBytes / 1024 << std::setw(14) << sample.peakRssKb << '\n';
+		total += sample.millis;
+	}
+	out << std::left << std::setw(24) << "total" << std::right << std::setw(12) << total << '\n';
+	out.unsetf(std::ios::fixed);
+}
+
+void writeStagesJson(std::ostream& out, const std::vector<StageSample>& stages) {
+	out << '[';
+	for (size_t i = 0; i < stages.size(); i++) {
+		const StageSample& sample = stages[i];
+		if (i > 0) out << ',';
+		out << "{\"stage\":\"" << sample.name << "\",\"ms\":" << sample.millis
+		    << ",\"alloc_bytes\":" << sample.allocatedBytes << ",\"heap_bytes\":" << sample.heapBytes << ",\"peak_rss_kb\":" << sample.peakRssKb << '}';
+	}
+	out << ']';
+}
+
+ProfileScope::ProfileScope(const char* name) : profiler(activeProfiler), name(name) {
+	if (profiler == nullptr) return;
+	heapAtStart = heapInUse();
+	allocatedAtStart = bytesAllocated();
+	start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+	if (profiler == nullptr) return;
+	StageSample sample;
+	sample.millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	sample.name = name;
+	sample.allocatedBytes = bytesAllocated() - allocatedAtStart;
+	sample.heapBytes = heapInUse() - heapAtStart;
+	sample.peakRssKb = peakRssKb();
+	profiler->record(std::move(sample));
+}
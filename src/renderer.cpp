@@ -0,0 +1,79 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include "imagesource.h"
+#include "profiler.h"
+
+Renderer::Renderer(const Parameters& params)
+	: params(params),
+	  table(getGlyphTable(params.inverted)),
+	  subcells(getMaskGlyphTable(params.glyphMode)),
+	  encoder(params.cellColor, params.colorBits) {
+	if (this->params.threads == 0) this->params.threads = std::thread::hardware_concurrency();
+}
+
+RenderResult Renderer::fail(RenderError error, const char* what) {
+	std::strncpy(message.data(), what, message.size() - 1);
+	message.back() = '\0';
+	RenderResult result;
+	result.error = error;
+	return result;
+}
+
+RenderResult Renderer::render(const uint16_t* lumaPlane, const uint8_t* rgbPlane, int width, int height, std::string& out) {
+	if (width <= 0 || height <= 0) return fail(RenderError::EmptyImage, "Image has no pixels");
+
+	const bool subcell = params.glyphMode != GlyphMode::Shade;
+	const int cellsWide = subcell ? width / subcells.columns : width;
+	const int cellsHigh = subcell ? height / subcells.rows : height;
+	if (cellsWide == 0 || cellsHigh == 0) return fail(RenderError::EmptyImage, "Image is smaller than one cell");
+
+	if (params.cellColor != ColorMode::None && rgbPlane != nullptr) {
+		ProfileScope stage("color encoding");
+		const size_t cells = static_cast<size_t>(cellsWide) * cellsHigh;
+		scratch.levels.resize(cells);
+		out.clear();
+		encoder.resetStats();
+		if (!subcell) {
+			quantizeLevels(lumaPlane, cells, table, scratch.levels.data());
+			encoder.encodeGrid(out, scratch.levels.data(), rgbPlane, width, height, table);
+		} else {
+			if (params.glyphMode == GlyphMode::HalfBlock) {
+				// Each half gets a color of its own, so the upper half block over the lower half's background is exact
+				std::fill(scratch.levels.begin(), scratch.levels.end(), 1);
+			} else {
+				computeMasks(lumaPlane, width, height, subcells, params.inverted, scratch.levels.data(), scratch);
+			}
+			encoder.encodeMaskGrid(out, scratch.levels.data(), rgbPlane, width, height, subcells);
+		}
+	} else {
+		ProfileScope stage("glyph mapping");
+		if (subcell) {
+			mapSubcells(lumaPlane, width, height, subcells, params.inverted, out, scratch, params.threads);
+		} else {
+			mapGlyphs(lumaPlane, width, height, table, out, scratch, params.threads);
+		}
+	}
+
+	message[0] = '\0';
+	RenderResult result;
+	result.bytes = out.size();
+	result.width = cellsWide;
+	result.height = cellsHigh;
+	return result;
+}
+
+RenderResult Renderer::renderFile(const std::string& path, std::string& out) {
+	Parameters fileParams = params;
+	fileParams.in_filepath = path;
+	ReducedGrid grid;
+	try {
+		grid = openImageSource(path)->reduce(fileParams);
+	} catch (const std::exception& e) {
+		return fail(RenderError::DecodeFailed, e.what());
+	}
+	const uint8_t* rgbPlane = params.cellColor != ColorMode::None ? grid.rgb.data() : nullptr;
+	return render(grid.luma.data(), rgbPlane, grid.width, grid.height, out);
+}
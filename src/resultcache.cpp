@@ -0,0 +1,78 @@
+#include "resultcache.h"
+
+namespace {
+	// Rough bookkeeping cost of one entry next to its key and art
+	constexpr size_t ENTRY_OVERHEAD = 128;
+}
+
+ResultCache::ResultCache(size_t capacityBytes) : capacity(capacityBytes) {}
+
+size_t ResultCache::entryBytes(const Entry& entry) {
+	return entry.key.size() + entry.art->size() + ENTRY_OVERHEAD;
+}
+
+std::shared_ptr<const std::string> ResultCache::get(const std::string& key) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const auto found = index.find(key);
+	if (found == index.end()) {
+		missCount++;
+		return nullptr;
+	}
+	hitCount++;
+	order.splice(order.begin(), order, found->second);
+	return found->second->art;
+}
+
+void ResultCache::put(const std::string& key, std::shared_ptr<const std::string> art) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const auto found = index.find(key);
+	if (found != index.end()) {
+		// Another worker rendered the same request concurrently, keep the existing entry
+		order.splice(order.begin(), order, found->second);
+		return;
+	}
+
+	Entry entry{key, std::move(art)};
+	const size_t size = entryBytes(entry);
+	if (size > capacity) return;
+
+	while (used + size > capacity && !order.empty()) {
+		used -= entryBytes(order.back());
+		index.erase(order.back().key);
+		order.pop_back();
+	}
+
+	order.push_front(std::move(entry));
+	index.emplace(order.front().key, order.begin());
+	used += size;
+}
+
+size_t ResultCache::hits() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return hitCount;
+}
+
+size_t ResultCache::misses() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return missCount;
+}
+
+size_t ResultCache::entries() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return order.size();
+}
+
+size_t ResultCache::bytes() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return used;
+}
+
+uint64_t contentHash(std::string_view data) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const unsigned char c : data) {
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
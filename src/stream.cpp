@@ -0,0 +1,373 @@
+#include "stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "batch.h"
+#include "boundedqueue.h"
+#include "colorhelper.h"
+
+using namespace Magick;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+	// Queue depth between stages: deep enough to absorb jitter, shallow enough to keep latency low
+	constexpr size_t STAGE_QUEUE_DEPTH = 3;
+	constexpr double DEFAULT_FPS = 24.0;
+	// Re-sending a few unchanged cells is cheaper than a new cursor-movement escape
+	constexpr int MAX_UNCHANGED_GAP = 3;
+
+	std::atomic<bool> stopRequested{false};
+
+	void requestStop(int) {
+		stopRequested = true;
+	}
+
+	struct DecodedFrame {
+		size_t index = 0;
+		double delay = 0;  // seconds until the next frame is due
+		Image image;
+	};
+
+	struct GrayFrame {
+		size_t index = 0;
+		double delay = 0;
+		int width = 0;
+		int height = 0;
+		std::vector<unsigned char> luma;
+		std::vector<unsigned char> rgb;  // only filled for per-cell color
+	};
+
+	struct CellFrame {
+		size_t index = 0;
+		double delay = 0;
+		int width = 0;
+		int height = 0;
+		std::vector<std::string_view> cells;
+		std::vector<uint32_t> colors;       // quantized per-cell colors, empty without per-cell color
+		std::vector<uint32_t> backgrounds;  // quantized background colors of the block element modes, else empty
+	};
+
+	/// Feeds frames of the source into the pipeline until it runs out or a stop is requested
+	void decodeStage(const StreamOptions& options, BoundedQueue<DecodedFrame>& out, StreamStats& stats) {
+		const double fixedDelay = options.fps > 0 ? 1.0 / options.fps : 0.0;
+		size_t index = 0;
+
+		if (options.source == "-") {
+			// Raw frames come from a live producer that cannot wait, so overflow drops the oldest frame
+			const size_t frameSize = static_cast<size_t>(options.raw_width) * options.raw_height;
+			std::vector<unsigned char> buffer(frameSize);
+			while (!stopRequested && std::fread(buffer.data(), 1, frameSize, stdin) == frameSize) {
+				DecodedFrame frame;
+				frame.index = index++;
+				frame.delay = fixedDelay > 0 ? fixedDelay : 1.0 / DEFAULT_FPS;
+				frame.image.read(options.raw_width, options.raw_height, "I", CharPixel, buffer.data());
+				stats.droppedSource += out.pushDropOldest(std::move(frame));
+				stats.decoded++;
+			}
+			return;
+		}
+
+		if (options.source.find_first_of("*?") != std::string::npos) {
+			// Image sequence, decoded lazily one file at a time
+			const auto paths = expandGlob(options.source);
+			if (paths.empty()) throw std::runtime_error("Frame pattern matched no files: " + options.source);
+			do {
+				for (const auto& path : paths) {
+					if (stopRequested) return;
+					DecodedFrame frame;
+					frame.index = index++;
+					frame.delay = fixedDelay > 0 ? fixedDelay : 1.0 / DEFAULT_FPS;
+					frame.image.read(path.string());
+					if (!out.push(std::move(frame))) return;
+					stats.decoded++;
+				}
+			} while (options.loop);
+			return;
+		}
+
+		// Animated image: frames have to be coalesced since later ones may only store a changed sub-rectangle
+		std::vector<Image> frames;
+		std::vector<Image> coalesced;
+		readImages(&frames, options.source);
+		coalesceImages(&coalesced, frames.begin(), frames.end());
+		frames.clear();
+		do {
+			for (const Image& image : coalesced) {
+				if (stopRequested) return;
+				DecodedFrame frame;
+				frame.index = index++;
+				if (fixedDelay > 0) {
+					frame.delay = fixedDelay;
+				} else {
+					// GIF delays are in 1/100 s, and 0 is conventionally played as 1/10 s
+					const size_t ticks = image.animationDelay();
+					frame.delay = ticks == 0 ? 0.1 : ticks / 100.0;
+				}
+				frame.image = image;
+				if (!out.push(std::move(frame))) return;
+				stats.decoded++;
+			}
+		} while (options.loop);
+	}
+
+	void resizeStage(const Parameters& params, BoundedQueue<DecodedFrame>& in, BoundedQueue<GrayFrame>& out) {
+		DecodedFrame frame;
+		while (in.pop(frame)) {
+			Parameters frameParams = params;
+			fitTargetSize(frameParams, frame.image.columns(), frame.image.rows());
+			frame.image.scale(gridGeometry(frameParams));
+
+			GrayFrame gray;
+			gray.index = frame.index;
+			gray.delay = frame.delay;
+			gray.width = frame.image.columns();
+			gray.height = frame.image.rows();
+			gray.luma.resize(static_cast<size_t>(gray.width) * gray.height);
+			frame.image.write(0, 0, gray.width, gray.height, "I", CharPixel, gray.luma.data());
+			if (params.cellColor != ColorMode::None) {
+				gray.rgb.resize(gray.luma.size() * 3);
+				frame.image.write(0, 0, gray.width, gray.height, "RGB", CharPixel, gray.rgb.data());
+			}
+			if (!out.push(std::move(gray))) return;
+		}
+	}
+
+	/// Glyphs and colors of a frame sampled at sub-pixels of the glyph mode, one string_view into the static mask table per cell
+	void mapSubcellFrame(const Parameters& params, const AnsiEncoder& encoder, const GrayFrame& gray, CellFrame& frame,
+	                     std::vector<uint16_t>& quanta, GlyphMapScratch& scratch) {
+		const MaskGlyphTable& table = getMaskGlyphTable(params.glyphMode);
+		frame.width = gray.width / table.columns;
+		frame.height = gray.height / table.rows;
+		const size_t cells = static_cast<size_t>(frame.width) * frame.height;
+
+		// 8-bit samples to the 16-bit quanta of the mask kernel, 257 maps 255 to 65535 exactly
+		quanta.resize(gray.luma.size());
+		for (size_t i = 0; i < gray.luma.size(); i++) quanta[i] = static_cast<uint16_t>(gray.luma[i] * 257);
+		scratch.levels.resize(cells);
+		if (!gray.rgb.empty() && params.glyphMode == GlyphMode::HalfBlock) {
+			// Same as Renderer: with color, both halves are drawn exactly as upper half block over background
+			std::fill(scratch.levels.begin(), scratch.levels.end(), 1);
+		} else {
+			computeMasks(quanta.data(), gray.width, gray.height, table, params.inverted, scratch.levels.data(), scratch);
+		}
+
+		frame.cells.resize(cells);
+		for (size_t i = 0; i < cells; i++) {
+			const uint8_t mask = scratch.levels[i];
+			frame.cells[i] = std::string_view(table.glyphs[mask].data(), table.lengths[mask]);
+		}
+		if (gray.rgb.empty()) return;
+
+		frame.colors.resize(cells);
+		if (table.fillsCell) frame.backgrounds.resize(cells);
+		uint8_t foreground[3];
+		uint8_t background[3];
+		for (int j = 0; j < frame.height; j++) {
+			for (int i = 0; i < frame.width; i++) {
+				const size_t cell = static_cast<size_t>(j) * frame.width + i;
+				splitCellColors(gray.rgb.data(), gray.width, i, j, scratch.levels[cell], table, foreground, background);
+				frame.colors[cell] = encoder.quantize(foreground[0], foreground[1], foreground[2]);
+				if (table.fillsCell) frame.backgrounds[cell] = encoder.quantize(background[0], background[1], background[2]);
+			}
+		}
+	}
+
+	void mapStage(const Parameters& params, const AnsiEncoder& encoder, BoundedQueue<GrayFrame>& in, BoundedQueue<CellFrame>& out) {
+		const auto& lut = getLUT(params.inverted);
+		std::vector<uint16_t> quanta;
+		GlyphMapScratch scratch;
+		GrayFrame gray;
+		while (in.pop(gray)) {
+			CellFrame frame;
+			frame.index = gray.index;
+			frame.delay = gray.delay;
+			if (params.glyphMode != GlyphMode::Shade) {
+				mapSubcellFrame(params, encoder, gray, frame, quanta, scratch);
+				if (!out.push(std::move(frame))) return;
+				continue;
+			}
+			frame.width = gray.width;
+			frame.height = gray.height;
+			frame.cells.resize(gray.luma.size());
+			for (size_t i = 0; i < gray.luma.size(); i++) {
+				frame.cells[i] = lut[gray.luma[i]];
+			}
+			if (!gray.rgb.empty()) {
+				frame.colors.resize(gray.luma.size());
+				for (size_t i = 0; i < gray.luma.size(); i++) {
+					frame.colors[i] = encoder.quantize(gray.rgb[i * 3], gray.rgb[i * 3 + 1], gray.rgb[i * 3 + 2]);
+				}
+			}
+			if (!out.push(std::move(frame))) return;
+		}
+	}
+
+	void appendCursorMove(std::string& out, int row, int col) {
+		out += "\033[";
+		out += std::to_string(row + 1);
+		out += ';';
+		out += std::to_string(col + 1);
+		out += 'H';
+	}
+
+	bool cellChanged(const CellFrame& prev, const CellFrame& frame, size_t cell) {
+		if (frame.cells[cell] != prev.cells[cell]) return true;
+		if (!frame.backgrounds.empty() && frame.backgrounds[cell] != prev.backgrounds[cell]) return true;
+		return !frame.colors.empty() && frame.colors[cell] != prev.colors[cell];
+	}
+
+	void appendCell(std::string& out, AnsiEncoder& encoder, const CellFrame& frame, size_t cell) {
+		if (!frame.backgrounds.empty()) {
+			encoder.appendCell(out, frame.cells[cell], frame.colors[cell], frame.backgrounds[cell]);
+			return;
+		}
+		encoder.appendCell(out, frame.cells[cell], frame.colors.empty() ? 0 : frame.colors[cell]);
+	}
+
+	/// Appends the escapes and glyphs that turn prev into frame on screen, or a full redraw if the size changed.
+	/// accent is the escape that colors every glyph, empty without an accent color.
+	void appendFrameDiff(std::string& out, AnsiEncoder& encoder, const CellFrame* prev, const CellFrame& frame,
+	                     const std::string& accent) {
+		const bool full = prev == nullptr || prev->width != frame.width || prev->height != frame.height;
+		if (full && prev != nullptr) {
+			// Reset colors first: clearing paints the screen with the current background. The reset drops the
+			// accent as well, so it is set again for the redraw.
+			out += "\033[0m\033[2J";
+			out += accent;
+			encoder.reset();
+		}
+
+		for (int j = 0; j < frame.height; j++) {
+			const size_t row = static_cast<size_t>(j) * frame.width;
+			if (full) {
+				appendCursorMove(out, j, 0);
+				for (int i = 0; i < frame.width; i++) appendCell(out, encoder, frame, row + i);
+				continue;
+			}
+
+			int i = 0;
+			while (i < frame.width) {
+				if (!cellChanged(*prev, frame, row + i)) {
+					i++;
+					continue;
+				}
+				// Extend the run over short stretches of unchanged cells
+				int end = i + 1;
+				int lastChanged = i;
+				while (end < frame.width && end - lastChanged <= MAX_UNCHANGED_GAP) {
+					if (cellChanged(*prev, frame, row + end)) lastChanged = end;
+					end++;
+				}
+				appendCursorMove(out, j, i);
+				for (int k = i; k <= lastChanged; k++) appendCell(out, encoder, frame, row + k);
+				i = lastChanged + 1;
+			}
+		}
+	}
+}
+
+StreamStats runStream(const StreamOptions& options, const Parameters& params) {
+	if (options.source == "-" && (options.raw_width <= 0 || options.raw_height <= 0)) {
+		throw std::invalid_argument("Raw frames on stdin need their size (--raw WxH)");
+	}
+	ensureMagick();
+
+	StreamStats stats;
+	AnsiEncoder encoder(params.cellColor, params.colorBits);
+	BoundedQueue<DecodedFrame> decoded(STAGE_QUEUE_DEPTH);
+	BoundedQueue<GrayFrame> resized(STAGE_QUEUE_DEPTH);
+	BoundedQueue<CellFrame> mapped(STAGE_QUEUE_DEPTH);
+
+	std::string error;
+	std::mutex errorMutex;
+	auto runStage = [&](auto&& stage, auto& closeAfter) {
+		return std::thread([&, stage, queue = &closeAfter] {
+			try {
+				stage();
+			} catch (const std::exception& e) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (error.empty()) error = e.what();
+				stopRequested = true;
+			}
+			queue->close();
+		});
+	};
+
+	// The accent color comes from the first frame. Working it out before the stages start lets its errors
+	// propagate without any threads to unwind.
+	std::string accent;
+	if (params.inColor && params.cellColor == ColorMode::None && options.source != "-") {
+		std::string firstFrame = options.source;
+		if (options.source.find_first_of("*?") != std::string::npos) {
+			const auto paths = expandGlob(options.source);
+			if (paths.empty()) throw std::runtime_error("Frame pattern matched no files: " + options.source);
+			firstFrame = paths.front().string();
+		}
+		auto [r, g, b] = extractAccentColor(firstFrame);
+		accent = makeAccentEscape(r, g, b);
+	}
+	std::string out = accent + "\033[?25l\033[2J";
+
+	stopRequested = false;
+	auto previousHandler = std::signal(SIGINT, requestStop);
+
+	std::thread decodeThread = runStage([&] { decodeStage(options, decoded, stats); }, decoded);
+	std::thread resizeThread = runStage([&] { resizeStage(params, decoded, resized); }, resized);
+	std::thread mapThread = runStage([&] { mapStage(params, encoder, resized, mapped); }, mapped);
+
+
+	CellFrame frame;
+	CellFrame shown;
+	bool haveShown = false;
+	Clock::time_point start;
+	Clock::time_point due;
+
+	while (!stopRequested && mapped.pop(frame)) {
+		const auto now = Clock::now();
+		const auto delay = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frame.delay));
+		if (!haveShown) {
+			start = due = now;
+		} else if (now > due + delay) {
+			// Already past the point where the next frame is due: skip this one instead of falling further behind
+			due += delay;
+			stats.droppedLate++;
+			continue;
+		}
+		std::this_thread::sleep_until(due);
+
+		appendFrameDiff(out, encoder, haveShown ? &shown : nullptr, frame, accent);
+		writeToStdout(out);
+		stats.bytes += out.size();
+		stats.emitted++;
+		out.clear();
+
+		due += delay;
+		std::swap(shown, frame);
+		haveShown = true;
+	}
+	if (haveShown) stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// Unblock and collect the stages, whichever way the stream ended
+	stopRequested = true;
+	decoded.close();
+	resized.close();
+	mapped.close();
+	decodeThread.join();
+	resizeThread.join();
+	mapThread.join();
+	std::signal(SIGINT, previousHandler);
+
+	out.clear();
+	if (haveShown) appendCursorMove(out, shown.height, 0);
+	out += "\033[0m\033[?25h";
+	writeToStdout(out);
+
+	if (!error.empty()) throw std::runtime_error(error);
+	return stats;
+}
@@ -0,0 +1,113 @@
+#include "threadpool.h"
+
+namespace {
+	// Index of the worker running on this thread, or -1 for outside threads
+	thread_local int currentWorker = -1;
+	thread_local const ThreadPool* currentPool = nullptr;
+}
+
+ThreadPool::ThreadPool(unsigned int threads) {
+	if (threads == 0) threads = std::thread::hardware_concurrency();
+	if (threads == 0) threads = 1;
+
+	queues.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		queues.push_back(std::make_unique<WorkQueue>());
+	}
+	workers.reserve(threads);
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	unsigned int target;
+	if (currentPool == this) {
+		target = static_cast<unsigned int>(currentWorker);
+	} else {
+		target = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[target]->mutex);
+		queues[target]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(stateMutex);
+		queued++;
+		unfinished++;
+	}
+	workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+	std::unique_lock<std::mutex> lock(stateMutex);
+	allDone.wait(lock, [this] { return unfinished == 0; });
+}
+
+bool ThreadPool::popLocal(unsigned int index, std::function<void()>& task) {
+	WorkQueue& queue = *queues[index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.tasks.empty()) return false;
+	// Newest first: it is most likely to still be warm in cache
+	task = std::move(queue.tasks.back());
+	queue.tasks.pop_back();
+	return true;
+}
+
+bool ThreadPool::steal(unsigned int thief, std::function<void()>& task) {
+	const std::size_t n = queues.size();
+	for (std::size_t offset = 1; offset < n; offset++) {
+		WorkQueue& victim = *queues[(thief + offset) % n];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.tasks.empty()) continue;
+		// Oldest first: keeps the victim's hot end untouched
+		task = std::move(victim.tasks.front());
+		victim.tasks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+	currentWorker = static_cast<int>(index);
+	currentPool = this;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(stateMutex);
+			workAvailable.wait(lock, [this] { return stopping || queued > 0; });
+			if (stopping && queued == 0) return;
+		}
+
+		std::function<void()> task;
+		if (!popLocal(index, task) && !steal(index, task)) {
+			// Another worker grabbed it between the wake-up and the pop
+			std::this_thread::yield();
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			queued--;
+		}
+
+		task();
+
+		bool last;
+		{
+			std::lock_guard<std::mutex> lock(stateMutex);
+			last = --unfinished == 0;
+		}
+		if (last) allDone.notify_all();
+	}
+}
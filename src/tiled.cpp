@@ -0,0 +1,405 @@
+#include "tiled.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bmp.h"
+#include "magickmodule.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+using namespace Magick;
+
+namespace {
+	// Rec. 709 luma weights in 1/256ths, gray samples are weighted with the full 256
+	constexpr uint32_t WEIGHT_R = 54;
+	constexpr uint32_t WEIGHT_G = 183;
+	constexpr uint32_t WEIGHT_B = 19;
+	constexpr uint32_t WEIGHT_TOTAL = 256;
+	// In-memory images below this many pixels per worker are reduced on the calling thread
+	constexpr size_t MIN_PIXELS_PER_WORKER = 1 << 22;
+
+	/// Running sums of the source pixels of one cell
+	struct CellSum {
+		uint64_t luma, r, g, b;
+	};
+
+	/// Source pixels [begin, end) along one axis that make up a cell
+	struct Span {
+		size_t begin, end;
+	};
+
+	// Splits pixels into cells contiguous spans. With more cells than pixels, neighbouring cells share a pixel.
+	std::vector<Span> cellSpans(size_t pixels, int cells) {
+		std::vector<Span> spans(cells);
+		for (int i = 0; i < cells; i++) {
+			spans[i].begin = pixels * i / cells;
+			spans[i].end = std::max(spans[i].begin + 1, pixels * (i + 1) / cells);
+		}
+		return spans;
+	}
+
+	// Sizes the grid chosen by fitTargetSize for a width x height source, one value per sub-pixel of the glyph mode.
+	// Row-sequential sources need every sub-pixel to cover its own pixels, so for them the cell count is clamped to
+	// what the source size can fill.
+	void initGrid(ReducedGrid& grid, Parameters& params, size_t width, size_t height, bool clampToSource) {
+		const int columns = subcellColumns(params.glyphMode);
+		const int rows = subcellRows(params.glyphMode);
+		const long maxWidth = clampToSource ? std::max<long>(1, width / columns) : std::numeric_limits<int>::max() / columns;
+		const long maxHeight = clampToSource ? std::max<long>(1, height / rows) : std::numeric_limits<int>::max() / rows;
+		const long cellsWide = std::clamp<long>(std::lround(params.target_width), 1, maxWidth);
+		const long cellsHigh = std::clamp<long>(std::lround(params.target_height), 1, maxHeight);
+		params.target_width = cellsWide;
+		params.target_height = cellsHigh;
+		grid.width = static_cast<int>(cellsWide * columns);
+		grid.height = static_cast<int>(cellsHigh * rows);
+		const size_t cells = static_cast<size_t>(grid.width) * grid.height;
+		grid.luma.assign(cells, 0);
+		grid.rgb.assign(cells * 3, 0);
+	}
+
+	// Turns the sums of one finished row of cells into grid values, maxval is the largest sample value of the source
+	void storeRow(ReducedGrid& grid, int y, const std::vector<CellSum>& sums, const std::vector<Span>& columns,
+	              size_t rows, double maxval) {
+		for (int x = 0; x < grid.width; x++) {
+			const size_t cell = static_cast<size_t>(y) * grid.width + x;
+			const double count = static_cast<double>(rows) * (columns[x].end - columns[x].begin);
+			const double toQuantum = 65535.0 / (count * maxval * WEIGHT_TOTAL);
+			const double toByte = 255.0 / (count * maxval);
+			grid.luma[cell] = static_cast<uint16_t>(std::min(65535.0, sums[x].luma * toQuantum + 0.5));
+			grid.rgb[cell * 3] = static_cast<uint8_t>(std::min(255.0, sums[x].r * toByte + 0.5));
+			grid.rgb[cell * 3 + 1] = static_cast<uint8_t>(std::min(255.0, sums[x].g * toByte + 0.5));
+			grid.rgb[cell * 3 + 2] = static_cast<uint8_t>(std::min(255.0, sums[x].b * toByte + 0.5));
+		}
+	}
+
+	template <bool Wide>
+	inline uint32_t readSample(const uint8_t* samples, size_t i) {
+		// Samples above 8 bits are big-endian, as in PNM
+		if (Wide) return static_cast<uint32_t>(samples[2 * i]) << 8 | samples[2 * i + 1];
+		return samples[i];
+	}
+
+	/// Adds one row of interleaved samples (1 channel gray or 3 channel rgb) to the sums of a row of cells
+	template <int Channels, bool Wide>
+	void accumulateRow(const uint8_t* row, const std::vector<Span>& columns, std::vector<CellSum>& sums) {
+		for (size_t cell = 0; cell < columns.size(); cell++) {
+			uint64_t luma = 0, r = 0, g = 0, b = 0;
+			for (size_t x = columns[cell].begin; x < columns[cell].end; x++) {
+				if (Channels == 1) {
+					const uint32_t v = readSample<Wide>(row, x);
+					luma += v;
+					r += v;
+				} else {
+					const uint32_t red = readSample<Wide>(row, x * 3);
+					const uint32_t green = readSample<Wide>(row, x * 3 + 1);
+					const uint32_t blue = readSample<Wide>(row, x * 3 + 2);
+					luma += WEIGHT_R * red + WEIGHT_G * green + WEIGHT_B * blue;
+					r += red;
+					g += green;
+					b += blue;
+				}
+			}
+			if (Channels == 1) {
+				sums[cell].luma += luma * WEIGHT_TOTAL;
+				sums[cell].r += r;
+				sums[cell].g += r;
+				sums[cell].b += r;
+			} else {
+				sums[cell].luma += luma;
+				sums[cell].r += r;
+				sums[cell].g += g;
+				sums[cell].b += b;
+			}
+		}
+	}
+
+	using RowAccumulator = void (*)(const uint8_t*, const std::vector<Span>&, std::vector<CellSum>&);
+
+	/// Read-only mapping of a whole file
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::string& path) {
+			const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+			struct stat info{};
+			if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+				void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+				if (mapped != MAP_FAILED) {
+					bytes = static_cast<const uint8_t*>(mapped);
+					length = static_cast<size_t>(info.st_size);
+				}
+			}
+			::close(fd);
+		}
+
+		~MappedFile() {
+			if (bytes != nullptr) ::munmap(const_cast<uint8_t*>(bytes), length);
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const uint8_t* data() const { return bytes; }
+		size_t size() const { return length; }
+
+		// Drops the pages of [offset, offset + count) from the resident set, the kernel reads them again if touched
+		void release(size_t offset, size_t count) const {
+			static const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+			const size_t begin = offset / pageSize * pageSize;
+			const size_t end = std::min(length, offset + count);
+			if (end > begin) ::madvise(const_cast<uint8_t*>(bytes) + begin, end - begin, MADV_DONTNEED);
+		}
+
+	private:
+		const uint8_t* bytes = nullptr;
+		size_t length = 0;
+	};
+
+	RowAccumulator rowAccumulator(const PixelLayout& layout) {
+		if (layout.channels == 1) return layout.maxval > 255 ? accumulateRow<1, true> : accumulateRow<1, false>;
+		return layout.maxval > 255 ? accumulateRow<3, true> : accumulateRow<3, false>;
+	}
+
+	/// Where reduceRows finds the source rows, addressed from the top
+	struct RowSource {
+		// Row r, either in place or decoded into scratch, which every task has its own of
+		std::function<const uint8_t*(size_t r, std::vector<uint8_t>& scratch)> row;
+		// Called once rows [begin, end) are summed, to drop them from memory again. May be empty.
+		std::function<void(size_t begin, size_t end)> release;
+	};
+
+	// Reduces the source rows into the sized grid, one task per row of cells, on a pool if there is more than one
+	// worker. Tasks sum chunkRows source rows at a time and release them right after.
+	void reduceRows(ReducedGrid& grid, const RowSource& source, const PixelLayout& layout, unsigned int workers,
+	                size_t chunkRows) {
+		const std::vector<Span> columns = cellSpans(layout.width, grid.width);
+		const std::vector<Span> rows = cellSpans(layout.height, grid.height);
+		const RowAccumulator accumulate = rowAccumulator(layout);
+
+		// Tasks write disjoint rows of the grid and need no locking
+		auto reduceCellRow = [&](int y) {
+			std::vector<CellSum> sums(grid.width, CellSum{0, 0, 0, 0});
+			std::vector<uint8_t> scratch;
+			for (size_t row = rows[y].begin; row < rows[y].end; row += chunkRows) {
+				const size_t end = std::min(rows[y].end, row + chunkRows);
+				for (size_t r = row; r < end; r++) accumulate(source.row(r, scratch), columns, sums);
+				if (source.release) source.release(row, end);
+			}
+			storeRow(grid, y, sums, columns, rows[y].end - rows[y].begin, layout.maxval);
+		};
+
+		if (workers <= 1) {
+			for (int y = 0; y < grid.height; y++) reduceCellRow(y);
+			return;
+		}
+		ThreadPool pool(workers);
+		for (int y = 0; y < grid.height; y++) pool.submit([&reduceCellRow, y] { reduceCellRow(y); });
+		pool.wait();
+	}
+
+	// Rows laid out one after the other at pixels
+	RowSource rowsInPlace(const uint8_t* pixels, const PixelLayout& layout) {
+		const size_t rowBytes = layout.rowBytes();
+		return {[pixels, rowBytes](size_t r, std::vector<uint8_t>&) { return pixels + r * rowBytes; }, nullptr};
+	}
+
+	unsigned int availableThreads(const Parameters& params) {
+		return params.threads != 0 ? params.threads : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Reduces rows mapped from file, storedRowBytes of them at a time in the file. Every worker keeps at most one
+	// chunk of source rows resident, so the budget decides both the number of workers and the chunk size.
+	ReducedGrid reduceMapped(Parameters& params, const MappedFile& file, const RowSource& source, const PixelLayout& layout,
+	                         size_t storedRowBytes, size_t memoryBudget) {
+		ReducedGrid grid;
+		fitTargetSize(params, layout.width, layout.height);
+		initGrid(grid, params, layout.width, layout.height, true);
+
+		const unsigned int workers = static_cast<unsigned int>(std::clamp<size_t>(memoryBudget / storedRowBytes, 1, availableThreads(params)));
+		const size_t chunkRows = std::max<size_t>(1, memoryBudget / (static_cast<size_t>(workers) * storedRowBytes));
+		::madvise(const_cast<uint8_t*>(file.data()), file.size(), MADV_SEQUENTIAL);
+
+		ProfileScope stage("strip reduce");
+		reduceRows(grid, source, layout, workers, chunkRows);
+		return grid;
+	}
+
+	ReducedGrid reducePnm(Parameters& params, const MappedFile& file, const PixelLayout& layout, size_t dataOffset,
+	                      size_t memoryBudget) {
+		const size_t rowBytes = layout.rowBytes();
+		RowSource source = rowsInPlace(file.data() + dataOffset, layout);
+		source.release = [&file, dataOffset, rowBytes](size_t begin, size_t end) {
+			file.release(dataOffset + begin * rowBytes, (end - begin) * rowBytes);
+		};
+		return reduceMapped(params, file, source, layout, rowBytes, memoryBudget);
+	}
+
+	// Rows are decoded by their index, so bottom-up files (the usual kind) come out the right way up
+	ReducedGrid reduceBmp(Parameters& params, const MappedFile& file, const BmpHeader& header, size_t memoryBudget) {
+		const BmpRows rows(file.data(), file.size(), header);
+		PixelLayout layout;
+		layout.width = rows.width();
+		layout.height = rows.height();
+		layout.channels = 3;
+
+		RowSource source;
+		source.row = [&rows, &layout](size_t r, std::vector<uint8_t>& scratch) {
+			scratch.resize(layout.rowBytes());
+			rows.decodeRow(r, scratch.data());
+			return static_cast<const uint8_t*>(scratch.data());
+		};
+		source.release = [&file, &rows](size_t begin, size_t end) {
+			// Bottom-up files store the rows [begin, end) in reverse, but still in one piece
+			const size_t first = std::min(rows.rowOffset(begin), rows.rowOffset(end - 1));
+			file.release(first, (end - begin) * rows.stride());
+		};
+		return reduceMapped(params, file, source, layout, rows.stride(), memoryBudget);
+	}
+
+	/// Everything the ImageMagick stream handler works on. The handler has no context argument and runs on the
+	/// thread that called ReadStream, so it finds its state through a thread_local.
+	struct StreamState {
+		Parameters* params;
+		ReducedGrid* grid;
+		std::vector<Span> columns;
+		std::vector<Span> rows;
+		std::vector<CellSum> sums;
+		size_t row = 0;      // next source row
+		int cellRow = 0;     // row of cells the source row belongs to
+		std::string error;
+	};
+
+	thread_local StreamState* activeStream = nullptr;
+
+	size_t streamRow(const MagickCore::Image* image, const void* pixels, const size_t columns) {
+		StreamState& state = *activeStream;
+		try {
+			if (state.columns.empty()) {
+				// The decoder may scale while decoding (jpeg:size), so size the grid by what actually arrives
+				initGrid(*state.grid, *state.params, image->columns, image->rows, true);
+				state.columns = cellSpans(image->columns, state.grid->width);
+				state.rows = cellSpans(image->rows, state.grid->height);
+				state.sums.assign(state.grid->width, CellSum{0, 0, 0, 0});
+			}
+		} catch (const std::exception& e) {
+			state.error = e.what();
+			return 0;
+		}
+		// Interlaced coders may deliver extra passes, the first one already covers every row
+		if (state.cellRow >= state.grid->height) return columns;
+
+		const PixelPacket* row = static_cast<const PixelPacket*>(pixels);
+		for (size_t cell = 0; cell < state.columns.size(); cell++) {
+			uint64_t luma = 0, r = 0, g = 0, b = 0;
+			for (size_t x = state.columns[cell].begin; x < state.columns[cell].end; x++) {
+				luma += WEIGHT_R * row[x].red + WEIGHT_G * row[x].green + WEIGHT_B * row[x].blue;
+				r += row[x].red;
+				g += row[x].green;
+				b += row[x].blue;
+			}
+			state.sums[cell].luma += luma;
+			state.sums[cell].r += r;
+			state.sums[cell].g += g;
+			state.sums[cell].b += b;
+		}
+
+		state.row++;
+		if (state.row == state.rows[state.cellRow].end) {
+			const Span& span = state.rows[state.cellRow];
+			storeRow(*state.grid, state.cellRow, state.sums, state.columns, span.end - span.begin, QuantumRange);
+			std::fill(state.sums.begin(), state.sums.end(), CellSum{0, 0, 0, 0});
+			state.cellRow++;
+		}
+		return columns;
+	}
+
+	ReducedGrid reduceStreamed(Parameters& params, size_t memoryBudget) {
+		ReducedGrid grid;
+		StreamState state;
+		state.params = &params;
+		state.grid = &grid;
+
+		std::string error;
+		activeStream = &state;
+		try {
+			magickModule().streamRows(params, memoryBudget, streamRow);
+		} catch (const std::exception& e) {
+			error = e.what();
+		}
+		activeStream = nullptr;
+
+		// A handler that gave up knows better why than the coder it stopped
+		if (!state.error.empty()) error = state.error;
+		if (!error.empty()) throw std::runtime_error(error);
+		if (state.columns.empty()) throw std::runtime_error("Image has no pixels");
+		return grid;
+	}
+}
+
+bool parsePnmHeader(const uint8_t* data, size_t size, PixelLayout& layout, size_t& dataOffset) {
+	if (size < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) return false;
+	layout.channels = data[1] == '5' ? 1 : 3;
+
+	size_t pos = 2;
+	size_t values[3];
+	for (size_t& value : values) {
+		// Whitespace and comments up to the end of their line separate the header fields
+		while (pos < size && (std::isspace(data[pos]) || data[pos] == '#')) {
+			if (data[pos] == '#') {
+				while (pos < size && data[pos] != '\n') pos++;
+			} else {
+				pos++;
+			}
+		}
+		if (pos >= size || !std::isdigit(data[pos])) return false;
+		value = 0;
+		while (pos < size && std::isdigit(data[pos]) && value < (size_t(1) << 40)) value = value * 10 + (data[pos++] - '0');
+	}
+	// Exactly one whitespace character between maxval and the samples
+	if (pos >= size || !std::isspace(data[pos])) return false;
+
+	layout.width = values[0];
+	layout.height = values[1];
+	layout.maxval = static_cast<uint32_t>(values[2]);
+	dataOffset = pos + 1;
+	if (layout.width == 0 || layout.height == 0 || values[2] == 0 || values[2] > 65535) return false;
+	return layout.rowBytes() <= (size - dataOffset) / layout.height;
+}
+
+ReducedGrid reducePixels(Parameters& params, const uint8_t* pixels, const PixelLayout& layout) {
+	ReducedGrid grid;
+	fitTargetSize(params, layout.width, layout.height);
+	initGrid(grid, params, layout.width, layout.height, false);
+
+	// Small images are done long before a worker would have started
+	const size_t worthwhile = std::max<size_t>(1, layout.width * layout.height / MIN_PIXELS_PER_WORKER);
+	const unsigned int workers = static_cast<unsigned int>(std::min<size_t>(availableThreads(params), worthwhile));
+	ProfileScope stage("area reduce");
+	reduceRows(grid, rowsInPlace(pixels, layout), layout, workers, layout.height);
+	return grid;
+}
+
+ReducedGrid reduceTiled(Parameters& params, size_t memoryBudget) {
+	memoryBudget = std::max<size_t>(memoryBudget, 1);
+	const MappedFile file(params.in_filepath);
+	PixelLayout layout;
+	size_t dataOffset = 0;
+	if (file.data() != nullptr && parsePnmHeader(file.data(), file.size(), layout, dataOffset)) {
+		return reducePnm(params, file, layout, dataOffset, memoryBudget);
+	}
+	// ImageMagick's BMP coder hands its rows over bottom-up, which the row-sequential stream handler cannot place
+	BmpHeader bmp;
+	if (file.data() != nullptr && parseBmpHeader(file.data(), file.size(), bmp)) return reduceBmp(params, file, bmp, memoryBudget);
+	return reduceStreamed(params, memoryBudget);
+}
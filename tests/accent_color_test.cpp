@@ -0,0 +1,145 @@
+// Checks extractAccentColor against the choice of the ImageMagick quantize pass it replaced, on a few fixed synthetic
+// images, and that an image without pixels falls back to the neutral gray instead of throwing
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <tuple>
+#include <vector>
+
+#include <asciirenderer.h>
+#include <colorhelper.h>
+
+using namespace Magick;
+
+namespace {
+	constexpr int IMAGE_WIDTH = 120;
+	constexpr int IMAGE_HEIGHT = 80;
+	// Largest RGB distance between the two picks that still counts as the same accent
+	constexpr double MAX_DISTANCE = 40.0;
+
+	struct Rgb {
+		uint8_t r, g, b;
+	};
+
+	/// Rectangle [x0, x1) x [y0, y1) in fractions of the image size, painted over the background
+	struct Patch {
+		double x0, y0, x1, y1;
+		Rgb color;
+	};
+
+	struct ImageCase {
+		const char* name;
+		Rgb background;
+		std::vector<Patch> patches;
+		int noise;  // amplitude of the xorshift noise added to every channel, 0 for flat colors
+	};
+
+	Image makeImage(const ImageCase& test) {
+		std::vector<uint8_t> rgb(static_cast<size_t>(IMAGE_WIDTH) * IMAGE_HEIGHT * 3);
+		uint32_t state = 0x2545f491u;
+		for (int y = 0; y < IMAGE_HEIGHT; y++) {
+			for (int x = 0; x < IMAGE_WIDTH; x++) {
+				Rgb color = test.background;
+				for (const Patch& patch : test.patches) {
+					if (x >= patch.x0 * IMAGE_WIDTH && x < patch.x1 * IMAGE_WIDTH && y >= patch.y0 * IMAGE_HEIGHT && y < patch.y1 * IMAGE_HEIGHT) {
+						color = patch.color;
+					}
+				}
+				uint8_t* p = &rgb[(static_cast<size_t>(y) * IMAGE_WIDTH + x) * 3];
+				const uint8_t channels[3] = {color.r, color.g, color.b};
+				for (int c = 0; c < 3; c++) {
+					int value = channels[c];
+					if (test.noise != 0) {
+						state ^= state << 13;
+						state ^= state >> 17;
+						state ^= state << 5;
+						value += static_cast<int>(state % (2 * test.noise + 1)) - test.noise;
+					}
+					p[c] = static_cast<uint8_t>(std::min(255, std::max(0, value)));
+				}
+			}
+		}
+		Image image;
+		image.read(IMAGE_WIDTH, IMAGE_HEIGHT, "RGB", CharPixel, rgb.data());
+		return image;
+	}
+
+	/// The accent color as extractAccentColor picked it before the histogram palette: blur a 100x100 copy, quantize
+	/// it to 5 colors and take the most vibrant entry of the color map
+	std::tuple<int,int,int> quantizedAccentColor(const Image& image) {
+		Image img(image);
+		img.resize("100x100!");
+		img.gaussianBlur(0, 1.0);
+		img.quantizeColors(5);
+		img.quantize();
+
+		double bestScore = -1.0;
+		int bestR = 128, bestG = 128, bestB = 128;
+		for (size_t i = 0; i < img.colorMapSize(); i++) {
+			const Color c = img.colorMap(i);
+			const double r = c.redQuantum() * 255.0 / QuantumRange;
+			const double g = c.greenQuantum() * 255.0 / QuantumRange;
+			const double b = c.blueQuantum() * 255.0 / QuantumRange;
+			const double maxc = std::max({r, g, b});
+			const double minc = std::min({r, g, b});
+			const double saturation = (maxc == 0.0) ? 0.0 : (maxc - minc) / maxc;
+			const double brightness = (r + g + b) / (3.0 * 255.0);
+			const double score = saturation * (0.4 + brightness);
+			if (score > bestScore) {
+				bestScore = score;
+				bestR = static_cast<int>(r);
+				bestG = static_cast<int>(g);
+				bestB = static_cast<int>(b);
+			}
+		}
+		return {bestR, bestG, bestB};
+	}
+
+	double distance(const std::tuple<int,int,int>& a, const std::tuple<int,int,int>& b) {
+		const double dr = std::get<0>(a) - std::get<0>(b);
+		const double dg = std::get<1>(a) - std::get<1>(b);
+		const double db = std::get<2>(a) - std::get<2>(b);
+		return std::sqrt(dr * dr + dg * dg + db * db);
+	}
+}
+
+int main(int, char const* argv[]) {
+	setMagickPath(*argv);
+	ensureMagick();
+
+	const ImageCase cases[] = {
+		{"patch on gray", {128, 128, 128}, {{0.3, 0.3, 0.7, 0.7, {230, 120, 30}}}, 0},
+		{"noisy patch on gray", {128, 128, 128}, {{0.3, 0.3, 0.7, 0.7, {230, 120, 30}}}, 12},
+		{"dull and vivid halves", {60, 70, 110}, {{0.5, 0.0, 1.0, 1.0, {40, 200, 60}}}, 0},
+		{"small block on dark", {20, 20, 25}, {{0.1, 0.2, 0.4, 0.6, {40, 210, 220}}, {0.6, 0.5, 0.9, 0.9, {240, 240, 240}}}, 0},
+		{"quadrants", {150, 150, 150}, {{0.0, 0.0, 0.5, 0.5, {200, 40, 40}}, {0.5, 0.0, 1.0, 0.5, {220, 200, 40}},
+		                                {0.0, 0.5, 0.5, 1.0, {20, 30, 80}}}, 0},
+	};
+
+	int failures = 0;
+	for (const ImageCase& test : cases) {
+		const Image image = makeImage(test);
+		const auto accent = extractAccentColor(image);
+		const auto quantized = quantizedAccentColor(image);
+		const double apart = distance(accent, quantized);
+		const bool ok = apart <= MAX_DISTANCE;
+		std::printf("%-22s accent %3d,%3d,%3d  quantize %3d,%3d,%3d  distance %5.1f  %s\n", test.name,
+		            std::get<0>(accent), std::get<1>(accent), std::get<2>(accent),
+		            std::get<0>(quantized), std::get<1>(quantized), std::get<2>(quantized), apart, ok ? "ok" : "FAILED");
+		if (!ok) failures++;
+	}
+
+	// Nothing to cluster, which has to end in the documented fallback rather than an exception
+	try {
+		const auto fallback = extractAccentColor(Image());
+		const bool ok = fallback == std::make_tuple(180, 180, 180);
+		std::printf("%-22s accent %3d,%3d,%3d  %s\n", "empty image", std::get<0>(fallback), std::get<1>(fallback),
+		            std::get<2>(fallback), ok ? "ok" : "FAILED");
+		if (!ok) failures++;
+	} catch (const std::exception& e) {
+		std::printf("%-22s threw: %s  FAILED\n", "empty image", e.what());
+		failures++;
+	}
+	return failures == 0 ? 0 : 1;
+}
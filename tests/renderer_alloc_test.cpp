@@ -0,0 +1,113 @@
+// Checks the allocation guarantee of Renderer: after a warm-up render, further renders of the same grid size through
+// the plane overload allocate nothing, in every glyph mode and color mode
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <renderer.h>
+
+namespace {
+	std::atomic<size_t> allocations{0};
+
+	constexpr int GRID_WIDTH = 160;
+	constexpr int GRID_HEIGHT = 60;
+	constexpr int RENDERS = 10;
+
+	struct GlyphCase {
+		const char* name;
+		GlyphMode mode;
+	};
+
+	struct ColorCase {
+		const char* name;
+		ColorMode mode;
+	};
+
+	/// Gradient with xorshift noise, so every glyph and many distinct colors show up
+	void makePlanes(int width, int height, std::vector<uint16_t>& luma, std::vector<uint8_t>& rgb) {
+		luma.resize(static_cast<size_t>(width) * height);
+		rgb.resize(luma.size() * 3);
+		uint32_t state = 0x2545f491u;
+		for (size_t i = 0; i < luma.size(); i++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			const uint32_t gradient = static_cast<uint32_t>(i * 65535 / luma.size());
+			luma[i] = static_cast<uint16_t>(gradient / 2 + (state & 0x7fff));
+			rgb[i * 3] = static_cast<uint8_t>(state);
+			rgb[i * 3 + 1] = static_cast<uint8_t>(state >> 8);
+			rgb[i * 3 + 2] = static_cast<uint8_t>(gradient >> 8);
+		}
+	}
+}
+
+void* operator new(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+int main() {
+	const GlyphCase glyphCases[] = {
+		{"shade", GlyphMode::Shade}, {"half", GlyphMode::HalfBlock},
+		{"quadrant", GlyphMode::Quadrant}, {"braille", GlyphMode::Braille}
+	};
+	const ColorCase colorCases[] = {
+		{"none", ColorMode::None}, {"truecolor", ColorMode::TrueColor}, {"256", ColorMode::Palette256}
+	};
+
+	int failures = 0;
+	for (const GlyphCase& glyphs : glyphCases) {
+		const int width = GRID_WIDTH * subcellColumns(glyphs.mode);
+		const int height = GRID_HEIGHT * subcellRows(glyphs.mode);
+		std::vector<uint16_t> luma;
+		std::vector<uint8_t> rgb;
+		makePlanes(width, height, luma, rgb);
+
+		for (const ColorCase& color : colorCases) {
+			for (bool inverted : {false, true}) {
+				Parameters params;
+				params.glyphMode = glyphs.mode;
+				params.cellColor = color.mode;
+				params.inverted = inverted;
+				params.threads = 1;
+				const uint8_t* rgbPlane = color.mode != ColorMode::None ? rgb.data() : nullptr;
+
+				Renderer renderer(params);
+				std::string art;
+				const RenderResult warmup = renderer.render(luma.data(), rgbPlane, width, height, art);
+				if (!warmup || warmup.width != GRID_WIDTH || warmup.height != GRID_HEIGHT) {
+					std::fprintf(stderr, "%s/%s: warm-up render failed: %s\n", glyphs.name, color.name, renderer.errorMessage());
+					failures++;
+					continue;
+				}
+				const std::string expected = art;
+
+				const size_t before = allocations.load();
+				bool identical = true;
+				for (int r = 0; r < RENDERS; r++) {
+					renderer.render(luma.data(), rgbPlane, width, height, art);
+					identical = identical && art == expected;
+				}
+				const size_t allocated = allocations.load() - before;
+
+				const bool ok = allocated == 0 && identical;
+				std::printf("%-9s %-10s %-9s %s (%zu allocations in %d renders)\n", glyphs.name, color.name,
+				            inverted ? "inverted" : "plain", ok ? "ok" : "FAILED", allocated, RENDERS);
+				if (!ok) failures++;
+			}
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
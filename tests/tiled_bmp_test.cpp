@@ -0,0 +1,125 @@
+// Checks that --maxmem renders BMP files the right way up: the strip reduction of reduceTiled has to match the
+// in-memory decode for bottom-up and top-down files of every depth, with a budget small enough to force one source
+// row per chunk
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <imagesource.h>
+#include <tiled.h>
+
+namespace {
+	constexpr int IMAGE_WIDTH = 90;
+	constexpr int IMAGE_HEIGHT = 64;
+	constexpr size_t MEMORY_BUDGET = 1;
+
+	struct BmpCase {
+		const char* name;
+		int bitsPerPixel;
+		bool topDown;
+	};
+
+	void putLe16(std::vector<uint8_t>& out, uint32_t value) {
+		out.push_back(static_cast<uint8_t>(value));
+		out.push_back(static_cast<uint8_t>(value >> 8));
+	}
+
+	void putLe32(std::vector<uint8_t>& out, uint32_t value) {
+		putLe16(out, value & 0xFFFF);
+		putLe16(out, value >> 16);
+	}
+
+	/// Bright at the top and dark at the bottom with a colored band on the left, so a flipped or shifted reduction
+	/// shows in the luma as well as in the colors
+	void pixelAt(int x, int y, uint8_t& r, uint8_t& g, uint8_t& b) {
+		const uint8_t level = static_cast<uint8_t>(255 - y * 255 / (IMAGE_HEIGHT - 1));
+		r = level;
+		g = x < IMAGE_WIDTH / 4 ? 40 : level;
+		b = static_cast<uint8_t>(x * 255 / (IMAGE_WIDTH - 1));
+	}
+
+	// 8 bit files use a 256 entry palette indexed by the gray level, 24 and 32 bit files store blue, green, red
+	std::vector<uint8_t> makeBmp(const BmpCase& test) {
+		const size_t stride = (static_cast<size_t>(IMAGE_WIDTH) * test.bitsPerPixel + 31) / 32 * 4;
+		const uint32_t paletteBytes = test.bitsPerPixel == 8 ? 256 * 4 : 0;
+		const uint32_t dataOffset = 14 + 40 + paletteBytes;
+
+		std::vector<uint8_t> file = {'B', 'M'};
+		putLe32(file, static_cast<uint32_t>(dataOffset + stride * IMAGE_HEIGHT));
+		putLe32(file, 0);
+		putLe32(file, dataOffset);
+		putLe32(file, 40);
+		putLe32(file, IMAGE_WIDTH);
+		putLe32(file, static_cast<uint32_t>(test.topDown ? -IMAGE_HEIGHT : IMAGE_HEIGHT));
+		putLe16(file, 1);
+		putLe16(file, static_cast<uint32_t>(test.bitsPerPixel));
+		for (int i = 0; i < 6; i++) putLe32(file, 0);  // uncompressed, no size, resolution or palette counts
+		for (uint32_t i = 0; i < paletteBytes / 4; i++) putLe32(file, i << 16 | i << 8 | i);
+
+		for (int stored = 0; stored < IMAGE_HEIGHT; stored++) {
+			const int y = test.topDown ? stored : IMAGE_HEIGHT - 1 - stored;
+			std::vector<uint8_t> row;
+			for (int x = 0; x < IMAGE_WIDTH; x++) {
+				uint8_t r, g, b;
+				pixelAt(x, y, r, g, b);
+				if (test.bitsPerPixel == 8) {
+					row.push_back(r);
+				} else {
+					row.insert(row.end(), {b, g, r});
+					if (test.bitsPerPixel == 32) row.push_back(0);
+				}
+			}
+			row.resize(stride, 0);
+			file.insert(file.end(), row.begin(), row.end());
+		}
+		return file;
+	}
+
+	Parameters makeParams(const std::string& path) {
+		Parameters params;
+		params.in_filepath = path;
+		params.target_width = 30;
+		params.threads = 4;
+		return params;
+	}
+}
+
+int main() {
+	const BmpCase cases[] = {
+		{"8 bit bottom-up", 8, false},
+		{"24 bit bottom-up", 24, false},
+		{"24 bit top-down", 24, true},
+		{"32 bit bottom-up", 32, false},
+	};
+	const std::string path = (std::filesystem::temp_directory_path() / "asciirenderer_tiled_bmp_test.bmp").string();
+
+	int failures = 0;
+	for (const BmpCase& test : cases) {
+		const std::vector<uint8_t> file = makeBmp(test);
+		std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(file.data()), file.size());
+
+		try {
+			Parameters inMemoryParams = makeParams(path);
+			const ReducedGrid expected = openImageSource(path)->reduce(inMemoryParams);
+			Parameters tiledParams = makeParams(path);
+			const ReducedGrid tiled = reduceTiled(tiledParams, MEMORY_BUDGET);
+
+			const bool sameGrid = tiled.width == expected.width && tiled.height == expected.height &&
+			                      tiled.luma == expected.luma && tiled.rgb == expected.rgb;
+			// Independent of the in-memory decoder: the first row has to be the bright one
+			const bool upright = !tiled.luma.empty() && tiled.luma.front() > tiled.luma.back();
+			const bool ok = sameGrid && upright;
+			std::printf("%-18s %dx%d  %s%s\n", test.name, tiled.width, tiled.height, ok ? "ok" : "FAILED",
+			            upright ? "" : " (upside down)");
+			if (!ok) failures++;
+		} catch (const std::exception& e) {
+			std::printf("%-18s threw: %s  FAILED\n", test.name, e.what());
+			failures++;
+		}
+	}
+	std::filesystem::remove(path);
+	return failures == 0 ? 0 : 1;
+}